@@ -46,8 +46,8 @@ PCH_RELEASE += $(PCH)
 PCH_DEBUG += $(PCH)
 
 # Build directories
-RELEASE_DIR = release
-DEBUG_DIR = debug
+RELEASE_DIR ?= release
+DEBUG_DIR ?= debug
 BIN_DIR = bin
 LIB_DIR = lib
 OBJ_DIR = obj
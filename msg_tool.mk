@@ -0,0 +1,30 @@
+TARGET = particle_msg_tool
+TARGET_TYPE = bin
+
+SRC = src/logging/msg_server.cpp \
+  src/logging/msg_index.cpp \
+  src/logging/msg_journal.cpp \
+  src/logging/msg_manifest.cpp \
+  src/logging/bin_index.cpp \
+  src/logging/shm_index.cpp \
+  src/util/json.cpp \
+  src/util/elf.cpp \
+  src/util/variant.cpp \
+  src/msg_tool.cpp
+
+INCLUDE_PATH = src
+
+LIB = boost_system \
+  boost_filesystem \
+  pthread \
+  rt
+
+# Use separate build directories, since the plugin's object files are compiled with different options
+RELEASE_DIR = release/msg_tool
+DEBUG_DIR = debug/msg_tool
+
+# Dependencies
+INCLUDE_PATH += $(BOOST_INCLUDE_PATH) $(RAPIDJSON_INCLUDE_PATH)
+LIB_PATH += $(BOOST_LIB_PATH)
+
+include gcc-c++.mk
@@ -15,18 +15,15 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-// GCC 5.4.x: This header file conflicts with some of the GCC's macro definitions
-#include <regex>
-
 #include "logging/attr_parser.h"
 
 #include "plugin/gcc_defs.h"
 #include "util/string.h"
 #include "debug.h"
 
-#include <boost/algorithm/string.hpp>
-
-#include <list>
+#include <algorithm>
+#include <exception>
+#include <cstring>
 
 namespace particle {
 
@@ -41,95 +38,204 @@ std::string getSourceLine(const expanded_location& loc) {
     return std::string(data, len);
 }
 
+inline bool isSpace(char c) {
+    return (c == ' ' || (c >= '\t' && c <= '\r'));
+}
+
+inline bool isDigit(char c) {
+    return (c >= '0' && c <= '9');
+}
+
+// Excludes leading and trailing whitespace characters from a range of a string
+void trim(const std::string& str, size_t* begin, size_t* end) {
+    while (*begin < *end && isSpace(str.at(*begin))) {
+        ++*begin;
+    }
+    while (*end > *begin && isSpace(str.at(*end - 1))) {
+        --*end;
+    }
+}
+
+bool startsWith(const std::string& str, size_t begin, size_t end, const char* s) {
+    return (end - begin >= 2 && str.at(begin) == s[0] && str.at(begin + 1) == s[1]);
+}
+
+bool endsWith(const std::string& str, size_t begin, size_t end, const char* s) {
+    return (end - begin >= 2 && str.at(end - 2) == s[0] && str.at(end - 1) == s[1]);
+}
+
+inline bool isAttrLine(const std::string& line, size_t begin, size_t end) {
+    return (begin < end && (line.at(begin) == '@' || line.at(begin) == '\\'));
+}
+
+inline bool isAttrLine(const std::string& line) {
+    return isAttrLine(line, 0, line.size());
+}
+
+// Matches a line of the form "<c><name><spaces><value>", where <c> is an arbitrary character
+bool matchTag(const std::string& line, const char* name, std::string* value) {
+    const size_t n = strlen(name);
+    if (line.size() <= n || line.compare(1, n, name) != 0) {
+        return false;
+    }
+    size_t pos = n + 1;
+    while (pos < line.size() && isSpace(line.at(pos))) {
+        ++pos;
+    }
+    if (pos == line.size()) {
+        return false;
+    }
+    *value = line.substr(pos);
+    return true;
+}
+
 } // namespace
 
 void AttrParser::parse(Location loc) {
-    boost::optional<std::string> hintMsg, helpId;
-    boost::optional<MsgId> msgId;
-    // Extract the comments block preceeding the logging statement
-    expanded_location expLoc = expand_location(loc);
-    std::list<std::string> lines;
-    std::string line = getSourceLine(expLoc);
-    line = line.substr(0, expLoc.column - 1); // Column numbers are 1-based
-    bool multiLine = false;
-    bool singleLine = false;
-    for (;;) {
-        boost::trim(line);
-        if (multiLine) {
-            const size_t p = line.rfind("/*");
+    hintMsg_ = boost::none;
+    helpId_ = boost::none;
+    msgId_ = boost::none;
+    // Find the comments block preceeding the logging statement
+    const expanded_location expLoc = expand_location(loc);
+    const Block* block = nullptr;
+    Block inlineBlock;
+    if (expLoc.file && expLoc.line > 0) { // Line numbers are 1-based
+        SourceFile& file = files_[expLoc.file];
+        scanFile(&file, expLoc);
+        const std::string& line = file.lines.at(expLoc.line - 1);
+        size_t begin = 0, end = std::min<size_t>(expLoc.column - 1, line.size()); // Column numbers are 1-based
+        trim(line, &begin, &end);
+        if (begin == end) {
+            const int b = (expLoc.line > 1) ? file.lineBlocks.at(expLoc.line - 2) : -1;
+            if (b >= 0) {
+                block = &file.blocks.at(b);
+            }
+        } else if (endsWith(line, begin, end, "*/")) {
+            // The comments block ends on the same line with the statement
+            inlineBlock = multiLineBlock(file, line, end - 2, expLoc.line);
+            block = &inlineBlock;
+        }
+    }
+    // Check if the comments block contains Doxygen-alike named parameters
+    if (block) {
+        if (block->error) {
+            std::rethrow_exception(block->error);
+        }
+        msgId_ = block->msgId;
+        hintMsg_ = block->hintMsg;
+        helpId_ = block->helpId;
+    }
+}
+
+void AttrParser::scanFile(SourceFile* file, expanded_location loc) {
+    const int lastLine = loc.line;
+    for (int n = file->lines.size() + 1; n <= lastLine; ++n) {
+        loc.line = n;
+        file->lines.push_back(getSourceLine(loc));
+        const std::string& line = file->lines.back();
+        size_t begin = 0, end = line.size();
+        trim(line, &begin, &end);
+        int b = file->lineBlocks.empty() ? -1 : file->lineBlocks.back(); // Empty lines are skipped
+        if (startsWith(line, begin, end, "//")) {
             // Trim fancy comment formatting
-            size_t n = (p != std::string::npos) ? p + 2: 0;
-            while (n < line.size() && line.at(n) == '*') {
-                ++n;
+            size_t pos = begin + 2;
+            while (pos < end && line.at(pos) == '/') {
+                ++pos;
             }
-            if (n > 0) {
-                line = line.substr(n);
-                boost::trim_left(line);
+            while (pos < end && isSpace(line.at(pos))) {
+                ++pos;
             }
-            lines.push_front(line);
-            if (p != std::string::npos) {
-                break; // End of the comments block
+            if (file->singleLineBlock < 0) {
+                file->blocks.push_back(Block());
+                file->singleLineBlock = file->blocks.size() - 1;
             }
-        } else if (singleLine) {
-            if (boost::starts_with(line, "//")) {
-                // Trim fancy comment formatting
-                size_t n = 2;
-                while (n < line.size() && line.at(n) == '/') {
-                    ++n;
+            // Blocks of the preceding lines are kept intact, so the block is copied when a line adds an attribute
+            if (isAttrLine(line, pos, end)) {
+                Block block = file->blocks.at(file->singleLineBlock);
+                if (addLine(&block, line.substr(pos, end - pos))) {
+                    file->blocks.push_back(std::move(block));
+                    file->singleLineBlock = file->blocks.size() - 1;
                 }
-                line = line.substr(n);
-                boost::trim_left(line);
-                lines.push_front(line);
-            } else if (!line.empty()) {
-                break; // End of the comments block
-            }
-        } else {
-            if (boost::ends_with(line, "*/")) {
-                line.resize(line.size() - 2);
-                multiLine = true;
-                continue;
-            } else if (boost::starts_with(line, "//")) {
-                singleLine = true;
-                continue;
-            } else if (!line.empty()) {
-                break; // No comments block found
             }
+            b = file->singleLineBlock;
+        } else if (begin != end) {
+            file->singleLineBlock = -1; // End of the single-line comments
+            b = -1;
         }
-        // Get the previous line
-        if (--expLoc.line <= 0) { // Line numbers are 1-based
-            break; // End of the comments block
+        if (endsWith(line, begin, end, "*/")) {
+            file->blocks.push_back(multiLineBlock(*file, line, end - 2, n));
+            b = file->blocks.size() - 1;
         }
-        line = getSourceLine(expLoc);
+        file->lineBlocks.push_back(b);
     }
-    // Check if the comments block contains Doxygen-alike named parameters
-    for (const std::string& line: lines) {
-        if (line.empty() || (line.front() != '@' && line.front() != '\\')) {
-            continue;
+}
+
+AttrParser::Block AttrParser::multiLineBlock(const SourceFile& file, const std::string& line, size_t end,
+        int lineNum) {
+    // Walk back to the beginning of the comments block
+    std::vector<std::string> attrLines;
+    const std::string* s = &line;
+    for (;;) {
+        size_t begin = 0;
+        trim(*s, &begin, &end);
+        const size_t p = (end - begin >= 2) ? s->rfind("/*", end - 2) : std::string::npos;
+        const bool blockBegin = (p != std::string::npos && p >= begin);
+        // Trim fancy comment formatting
+        size_t pos = blockBegin ? p + 2 : begin;
+        while (pos < end && s->at(pos) == '*') {
+            ++pos;
+        }
+        while (pos < end && isSpace(s->at(pos))) {
+            ++pos;
+        }
+        if (isAttrLine(*s, pos, end)) {
+            attrLines.push_back(s->substr(pos, end - pos));
         }
-        static const std::regex ID_REGEX(".id\\s*(\\d+)");
-        static const std::regex HINT_REGEX(".hint\\s*(.+)");
-        static const std::regex HELP_REGEX(".help\\s*(.+)"); // TODO: Validate the identifier syntax
-        std::smatch m;
-        if (std::regex_match(line, m, ID_REGEX)) {
-            if (msgId) {
+        if (blockBegin || --lineNum <= 0) {
+            break; // End of the comments block
+        }
+        s = &file.lines.at(lineNum - 1);
+        end = s->size();
+    }
+    Block block;
+    for (auto it = attrLines.rbegin(); it != attrLines.rend(); ++it) {
+        addLine(&block, *it);
+    }
+    return block;
+}
+
+bool AttrParser::addLine(Block* block, const std::string& line) {
+    if (!isAttrLine(line) || block->error) {
+        return false;
+    }
+    // Errors are reported when the block is looked up
+    try {
+        std::string value;
+        if (matchTag(line, "id", &value)) {
+            if (!std::all_of(value.begin(), value.end(), isDigit)) {
+                return false;
+            }
+            if (block->msgId) {
                 throw ParsingError("Duplicate attribute: `id`");
             }
-            msgId = fromStr<MsgId>(m.str(1));
-        } else if (std::regex_match(line, m, HINT_REGEX)) {
-            if (hintMsg) {
+            block->msgId = fromStr<MsgId>(value);
+        } else if (matchTag(line, "hint", &value)) {
+            if (block->hintMsg) {
                 throw ParsingError("Duplicate attribute: `hint`");
             }
-            hintMsg = m.str(1);
-        } else if (std::regex_match(line, m, HELP_REGEX)) {
-            if (helpId) {
+            block->hintMsg = value;
+        } else if (matchTag(line, "help", &value)) { // TODO: Validate the identifier syntax
+            if (block->helpId) {
                 throw ParsingError("Duplicate attribute: `help`");
             }
-            helpId = m.str(1);
+            block->helpId = value;
+        } else {
+            return false;
         }
+    } catch (...) {
+        block->error = std::current_exception();
     }
-    hintMsg_.swap(hintMsg);
-    helpId_.swap(helpId);
-    msgId_.swap(msgId);
+    return true;
 }
 
 } // namespace particle
@@ -24,8 +24,15 @@
 
 #include <boost/optional.hpp>
 
+#include <unordered_map>
+#include <vector>
+#include <exception>
+
 namespace particle {
 
+// Parser of the attributes specified in the comments block preceding a logging statement. The comment blocks
+// of a source file are indexed when the parser encounters the file for the first time, so the parser instance
+// should be reused for all statements of a translation unit
 class AttrParser {
 public:
     class ParsingError;
@@ -35,6 +42,9 @@ public:
 
     void parse(Location loc);
 
+    // Releases the indexed source files
+    void clearCache();
+
     MsgId msgId() const;
     bool hasMsgId() const;
 
@@ -47,8 +57,32 @@ public:
     bool hasAttrs() const;
 
 private:
+    // Attributes found in a comments block
+    struct Block {
+        boost::optional<std::string> hintMsg, helpId;
+        boost::optional<MsgId> msgId;
+        std::exception_ptr error; // Set if the block contains invalid attributes
+    };
+
+    // Comment blocks of a source file. The file is scanned up to the last line requested so far
+    struct SourceFile {
+        std::vector<std::string> lines;
+        std::vector<int> lineBlocks; // Block found by walking back from each line, or -1
+        std::vector<Block> blocks;
+        int singleLineBlock; // Block of the current run of single-line comments, or -1
+
+        SourceFile() :
+                singleLineBlock(-1) {
+        }
+    };
+
+    std::unordered_map<std::string, SourceFile> files_;
     boost::optional<std::string> hintMsg_, helpId_;
     boost::optional<MsgId> msgId_;
+
+    static void scanFile(SourceFile* file, expanded_location loc);
+    static Block multiLineBlock(const SourceFile& file, const std::string& line, size_t end, int lineNum);
+    static bool addLine(Block* block, const std::string& line);
 };
 
 class AttrParser::ParsingError: public Error {
@@ -66,6 +100,10 @@ inline AttrParser::AttrParser(Location loc) {
     parse(loc);
 }
 
+inline void AttrParser::clearCache() {
+    files_.clear();
+}
+
 inline MsgId AttrParser::msgId() const {
     return (msgId_ ? *msgId_ : INVALID_MSG_ID);
 }
@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/bin_index.h"
+
+#include "error.h"
+#include "debug.h"
+
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/stat.h>
+
+namespace ipc = boost::interprocess;
+
+namespace particle {
+
+namespace {
+
+const char BIN_INDEX_MAGIC[8] = { 'P', 'M', 'S', 'G', 'I', 'D', 'X', '\0' };
+const uint32_t BIN_INDEX_VERSION = 3;
+const uint32_t BIN_INDEX_BYTE_ORDER = 0x01020304;
+
+// Offset value for a missing optional string
+const uint32_t NO_STR = 0xffffffff;
+
+} // namespace
+
+struct BinIndexReader::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t srcSize;
+    int64_t srcTime;
+    int64_t srcTimeNsec;
+    uint64_t srcDev, srcIno;
+    uint64_t srcJournalSize;
+    uint64_t fileSize;
+    uint32_t msgCount;
+    uint32_t maxMsgId;
+    uint32_t bucketCount; // Power of two
+    uint32_t strSize;
+};
+
+struct BinIndexReader::Entry {
+    uint64_t hash;
+    uint32_t fmtStrOffs, fmtStrSize;
+    uint32_t hintMsgOffs, hintMsgSize;
+    uint32_t helpIdOffs, helpIdSize;
+    uint32_t msgId;
+    uint32_t reserved;
+};
+
+MsgFileStamp::MsgFileStamp(const fs::path& file, const fs::path& journalFile) :
+        MsgFileStamp() {
+    struct stat st = {};
+    if (::stat(file.string().data(), &st) != 0) {
+        throw Error("Unable to read message file: %s: %s", file.string(), std::strerror(errno));
+    }
+    size = st.st_size;
+    time = st.st_mtime;
+#ifdef __APPLE__
+    timeNsec = st.st_mtimespec.tv_nsec;
+#else
+    timeNsec = st.st_mtim.tv_nsec;
+#endif
+    dev = st.st_dev;
+    ino = st.st_ino;
+    if (!journalFile.empty()) {
+        boost::system::error_code ec;
+        journalSize = fs::file_size(journalFile, ec);
+        if (ec) {
+            journalSize = 0; // Journal doesn't exist
+        }
+    }
+}
+
+bool BinIndexReader::open(const fs::path& file, const MsgFileStamp& stamp, bool allowJournalAppends) {
+    close();
+    boost::system::error_code ec;
+    if (fs::file_size(file, ec) < sizeof(Header) || ec) {
+        return false;
+    }
+    file_ = ipc::file_mapping(file.string().data(), ipc::read_only);
+    region_ = ipc::mapped_region(file_, ipc::read_only);
+    // The file may have been replaced after its size was checked, so use the size of the mapped file
+    const uint64_t fileSize = region_.get_size();
+    if (fileSize < sizeof(Header)) {
+        close();
+        return false;
+    }
+    const char* const data = static_cast<const char*>(region_.get_address());
+    const Header* const h = reinterpret_cast<const Header*>(data);
+    if (std::memcmp(h->magic, BIN_INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != BIN_INDEX_VERSION ||
+            h->byteOrder != BIN_INDEX_BYTE_ORDER) {
+        DEBUG("Unsupported format of the binary index file: %s", file.string());
+        close();
+        return false;
+    }
+    MsgFileStamp srcStamp;
+    srcStamp.size = h->srcSize;
+    srcStamp.time = h->srcTime;
+    srcStamp.timeNsec = h->srcTimeNsec;
+    srcStamp.dev = h->srcDev;
+    srcStamp.ino = h->srcIno;
+    srcStamp.journalSize = h->srcJournalSize;
+    if (allowJournalAppends ? !srcStamp.isPrefixOf(stamp) : srcStamp != stamp) {
+        DEBUG("Binary index file is out of date: %s", file.string());
+        close();
+        return false;
+    }
+    const uint64_t bucketsSize = (uint64_t)h->bucketCount * sizeof(uint32_t);
+    const uint64_t entriesSize = (uint64_t)h->msgCount * sizeof(Entry);
+    if (h->fileSize != fileSize || h->fileSize != sizeof(Header) + bucketsSize + entriesSize + h->strSize ||
+            h->bucketCount == 0 || (h->bucketCount & (h->bucketCount - 1)) != 0 || h->msgCount >= h->bucketCount) {
+        throw Error("Invalid format of the binary index file: %s", file.string());
+    }
+    header_ = h;
+    buckets_ = reinterpret_cast<const uint32_t*>(data + sizeof(Header));
+    entries_ = reinterpret_cast<const Entry*>(data + sizeof(Header) + bucketsSize);
+    strs_ = data + sizeof(Header) + bucketsSize + entriesSize;
+    return true;
+}
+
+void BinIndexReader::close() {
+    header_ = nullptr;
+    buckets_ = nullptr;
+    entries_ = nullptr;
+    strs_ = nullptr;
+    region_ = ipc::mapped_region();
+    file_ = ipc::file_mapping();
+}
+
+MsgId BinIndexReader::find(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) const {
+    return find(MsgIndex::keyHash(fmtStr, hintMsg, helpId), fmtStr, hintMsg, helpId);
+}
+
+MsgId BinIndexReader::find(uint64_t hash, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) const {
+    assert(header_);
+    const auto strEqual = [this](uint32_t offs, uint32_t size, const boost::optional<std::string>& str) {
+        if (offs == NO_STR || !str) {
+            return (offs == NO_STR && !str);
+        }
+        if (size != str->size() || (uint64_t)offs + size > header_->strSize) {
+            return false;
+        }
+        return (std::memcmp(strs_ + offs, str->data(), size) == 0);
+    };
+    const uint32_t mask = header_->bucketCount - 1;
+    // Linear probing
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        const uint32_t n = buckets_[i];
+        if (n == 0) {
+            break; // Empty bucket
+        }
+        if (n > header_->msgCount) {
+            throw Error("Invalid format of the binary index file");
+        }
+        const Entry& e = entries_[n - 1];
+        if (e.hash == hash && strEqual(e.fmtStrOffs, e.fmtStrSize, fmtStr) &&
+                strEqual(e.hintMsgOffs, e.hintMsgSize, hintMsg) && strEqual(e.helpIdOffs, e.helpIdSize, helpId)) {
+            return e.msgId;
+        }
+    }
+    return INVALID_MSG_ID;
+}
+
+void BinIndexReader::prefetch(uint64_t hash) const {
+    assert(header_);
+    __builtin_prefetch(buckets_ + (hash & (header_->bucketCount - 1)));
+}
+
+unsigned BinIndexReader::msgCount() const {
+    return (header_ ? header_->msgCount : 0);
+}
+
+MsgId BinIndexReader::maxMsgId() const {
+    return (header_ ? header_->maxMsgId : INVALID_MSG_ID);
+}
+
+void BinIndexWriter::add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    Msg msg;
+    msg.id = id;
+    msg.fmtStr = fmtStr;
+    msg.hintMsg = hintMsg;
+    msg.helpId = helpId;
+    msgs_.push_back(std::move(msg));
+}
+
+void BinIndexWriter::add(const BinIndexReader& reader) {
+    assert(reader.isOpen());
+    const auto str = [&reader](uint32_t offs, uint32_t size) {
+        if ((uint64_t)offs + size > reader.header_->strSize) {
+            throw Error("Invalid format of the binary index file");
+        }
+        return std::string(reader.strs_ + offs, size);
+    };
+    msgs_.reserve(msgs_.size() + reader.msgCount());
+    for (unsigned i = 0; i < reader.msgCount(); ++i) {
+        const BinIndexReader::Entry& e = reader.entries_[i];
+        Msg msg;
+        msg.id = e.msgId;
+        msg.fmtStr = str(e.fmtStrOffs, e.fmtStrSize);
+        if (e.hintMsgOffs != NO_STR) {
+            msg.hintMsg = str(e.hintMsgOffs, e.hintMsgSize);
+        }
+        if (e.helpIdOffs != NO_STR) {
+            msg.helpId = str(e.helpIdOffs, e.helpIdSize);
+        }
+        msgs_.push_back(std::move(msg));
+    }
+}
+
+void BinIndexWriter::add(BinIndexWriter&& writer) {
+    if (msgs_.empty()) {
+        msgs_.swap(writer.msgs_);
+    } else {
+        msgs_.reserve(msgs_.size() + writer.msgs_.size());
+        std::move(writer.msgs_.begin(), writer.msgs_.end(), std::back_inserter(msgs_));
+    }
+    writer.msgs_.clear();
+}
+
+void BinIndexWriter::write(const fs::path& file, const MsgFileStamp& stamp) {
+    typedef BinIndexReader::Header Header;
+    typedef BinIndexReader::Entry Entry;
+    // Keep the load factor of the hash table below 0.5
+    uint32_t bucketCount = 16;
+    while (bucketCount < msgs_.size() * 2) {
+        bucketCount *= 2;
+    }
+    std::vector<uint32_t> buckets(bucketCount, 0);
+    std::vector<Entry> entries;
+    entries.reserve(msgs_.size());
+    std::string strs;
+    const auto addStr = [&strs](const std::string& str, uint32_t* offs, uint32_t* size) {
+        *offs = strs.size();
+        *size = str.size();
+        strs.append(str.data(), str.size() + 1); // Include term. null
+    };
+    // Entries are stored in the order of message IDs, so that the same set of messages always produces the same
+    // file contents
+    std::sort(msgs_.begin(), msgs_.end(), [](const Msg& m1, const Msg& m2) {
+        return (std::tie(m1.id, m1.fmtStr, m1.hintMsg, m1.helpId) < std::tie(m2.id, m2.fmtStr, m2.hintMsg, m2.helpId));
+    });
+    MsgId maxMsgId = INVALID_MSG_ID;
+    for (const Msg& msg: msgs_) {
+        Entry e = Entry();
+        e.hash = MsgIndex::keyHash(msg.fmtStr, msg.hintMsg, msg.helpId);
+        e.msgId = msg.id;
+        addStr(msg.fmtStr, &e.fmtStrOffs, &e.fmtStrSize);
+        e.hintMsgOffs = NO_STR;
+        if (msg.hintMsg) {
+            addStr(*msg.hintMsg, &e.hintMsgOffs, &e.hintMsgSize);
+        }
+        e.helpIdOffs = NO_STR;
+        if (msg.helpId) {
+            addStr(*msg.helpId, &e.helpIdOffs, &e.helpIdSize);
+        }
+        const uint32_t mask = bucketCount - 1;
+        uint32_t i = e.hash & mask;
+        while (buckets[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        entries.push_back(e);
+        buckets[i] = entries.size(); // 1-based index of the entry
+        if (msg.id > maxMsgId) {
+            maxMsgId = msg.id;
+        }
+    }
+    if (strs.size() >= NO_STR) {
+        throw Error("Message index is too large");
+    }
+    Header h = Header();
+    std::memcpy(h.magic, BIN_INDEX_MAGIC, sizeof(h.magic));
+    h.version = BIN_INDEX_VERSION;
+    h.byteOrder = BIN_INDEX_BYTE_ORDER;
+    h.srcSize = stamp.size;
+    h.srcTime = stamp.time;
+    h.srcTimeNsec = stamp.timeNsec;
+    h.srcDev = stamp.dev;
+    h.srcIno = stamp.ino;
+    h.srcJournalSize = stamp.journalSize;
+    h.msgCount = entries.size();
+    h.maxMsgId = maxMsgId;
+    h.bucketCount = bucketCount;
+    h.strSize = strs.size();
+    h.fileSize = sizeof(Header) + buckets.size() * sizeof(uint32_t) + entries.size() * sizeof(Entry) + strs.size();
+    // Write to a temporary file first
+    const fs::path tmpFile = fs::unique_path(file.string() + ".%%%%-%%%%");
+    DEBUG("Writing binary index file: %s", file.string());
+    std::ofstream strm;
+    strm.exceptions(std::ios::badbit | std::ios::failbit); // Enable exceptions
+    try {
+        strm.open(tmpFile.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+        strm.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        strm.write(reinterpret_cast<const char*>(buckets.data()), buckets.size() * sizeof(uint32_t));
+        strm.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        strm.write(strs.data(), strs.size());
+        strm.close();
+        fs::rename(tmpFile, file);
+    } catch (const std::exception&) {
+        boost::system::error_code ec;
+        fs::remove(tmpFile, ec);
+        throw;
+    }
+}
+
+} // namespace particle
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/msg_index.h"
+#include "common.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <vector>
+#include <ctime>
+
+namespace particle {
+
+// Size, modification time and identity of the message file a binary index is built from. The modification time
+// is stored with nanosecond precision, so that a rewrite preserving the file size within the same second is
+// detected where the file system supports it
+struct MsgFileStamp {
+    uint64_t size;
+    int64_t time; // Seconds
+    int64_t timeNsec; // Nanoseconds
+    uint64_t dev, ino;
+    uint64_t journalSize; // Size of the message journal
+
+    MsgFileStamp() :
+            size(0),
+            time(0),
+            timeNsec(0),
+            dev(0),
+            ino(0),
+            journalSize(0) {
+    }
+
+    explicit MsgFileStamp(const fs::path& file, const fs::path& journalFile = fs::path());
+
+    bool operator==(const MsgFileStamp& stamp) const {
+        return (size == stamp.size && time == stamp.time && timeNsec == stamp.timeNsec && dev == stamp.dev &&
+                ino == stamp.ino && journalSize == stamp.journalSize);
+    }
+
+    bool operator!=(const MsgFileStamp& stamp) const {
+        return !operator==(stamp);
+    }
+
+    // Returns true if the given state of the message file differs from this one only by the records appended
+    // to the journal
+    bool isPrefixOf(const MsgFileStamp& stamp) const {
+        return (size == stamp.size && time == stamp.time && timeNsec == stamp.timeNsec && dev == stamp.dev &&
+                ino == stamp.ino && journalSize <= stamp.journalSize);
+    }
+};
+
+// Reader for the binary message index. The index file is memory-mapped and looked up via a hash table,
+// so the lookup time doesn't depend on the total number of messages in the index
+class BinIndexReader {
+public:
+    BinIndexReader();
+
+    // Maps the index file. Returns false if the file doesn't exist or is not up to date. If `allowJournalAppends`
+    // is true, an index that doesn't include the records appended to the journal since it was built is accepted
+    bool open(const fs::path& file, const MsgFileStamp& stamp, bool allowJournalAppends = false);
+    void close();
+
+    // Returns ID of a message or INVALID_MSG_ID if the message is not found
+    MsgId find(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId) const;
+
+    // Same as above, but takes a precomputed hash of the message attributes (see MsgIndex::keyHash())
+    MsgId find(uint64_t hash, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId) const;
+
+    // Loads the hash table bucket of a message into the CPU cache. Prefetching the buckets of a batch of messages
+    // before looking them up allows the memory accesses of the lookups to overlap
+    void prefetch(uint64_t hash) const;
+
+    unsigned msgCount() const;
+    MsgId maxMsgId() const;
+
+    bool isOpen() const;
+
+private:
+    struct Header;
+    struct Entry;
+
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    const Header* header_;
+    const uint32_t* buckets_;
+    const Entry* entries_;
+    const char* strs_;
+
+    friend class BinIndexWriter;
+};
+
+// Writer for the binary message index
+class BinIndexWriter {
+public:
+    BinIndexWriter();
+
+    void add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId);
+
+    // Adds all messages from another index
+    void add(const BinIndexReader& reader);
+
+    // Moves all messages from another writer
+    void add(BinIndexWriter&& writer);
+
+    // Writes the index file. The file is replaced atomically, so it's safe to call this method while
+    // other processes have the file mapped
+    void write(const fs::path& file, const MsgFileStamp& stamp);
+
+    unsigned msgCount() const;
+
+private:
+    struct Msg {
+        std::string fmtStr;
+        boost::optional<std::string> hintMsg, helpId;
+        MsgId id;
+    };
+
+    std::vector<Msg> msgs_;
+};
+
+inline BinIndexReader::BinIndexReader() :
+        header_(nullptr),
+        buckets_(nullptr),
+        entries_(nullptr),
+        strs_(nullptr) {
+}
+
+inline bool BinIndexReader::isOpen() const {
+    return header_;
+}
+
+inline BinIndexWriter::BinIndexWriter() {
+}
+
+inline unsigned BinIndexWriter::msgCount() const {
+    return msgs_.size();
+}
+
+} // namespace particle
@@ -19,9 +19,7 @@
 
 #include "debug.h"
 
-#include <boost/algorithm/string/join.hpp>
-
-#include <cctype>
+#include <cstring>
 
 namespace particle {
 
@@ -37,28 +35,137 @@ inline bool isOneOf(char c, const char* s) {
     return false;
 }
 
+inline bool isDigit(char c) {
+    return (c >= '0' && c <= '9');
+}
+
+// Returns the type code of an integer argument, or 0 if the size is not supported
+inline char intArgType(unsigned size) {
+    return (size == 16) ? ARG_INT16 : (size == 32) ? ARG_INT32 : (size == 64) ? ARG_INT64 : 0;
+}
+
+// Returns the next character of a null-terminated string. The terminating null character is not skipped and
+// doesn't match any part of a format specifier, so it's reported by the conversion specifier check
 inline char next(const char*& s) {
     const char c = *s;
-    if (c == '\0') {
-        throw FmtParser::ParsingError();
+    if (c != '\0') {
+        ++s;
     }
-    ++s;
     return c;
 }
 
 } // namespace
 
 void FmtParser::parse(const std::string& fmt) {
-    Specs specs;
-    specs.reserve(4);
+    fmt_ = fmt;
+    specs_.clear();
+    parseSpecs();
+}
+
+std::string FmtParser::joinSpecs(const std::string& sep) const {
+    std::string str;
+    if (!specs_.empty()) {
+        size_t size = (specs_.size() - 1) * sep.size();
+        for (const Spec& spec: specs_) {
+            size += spec.size;
+        }
+        str.reserve(size);
+        for (auto it = specs_.begin(); it != specs_.end(); ++it) {
+            if (it != specs_.begin()) {
+                str += sep;
+            }
+            str.append(fmt_, it->pos, it->size);
+        }
+    }
+    return str;
+}
+
+bool FmtParser::argTypes(const TypeSizes& sizes, std::string* types) const {
+    assert(types);
+    types->clear();
+    types->reserve(specs_.size());
+    for (const Spec& spec: specs_) {
+        // Arguments shorter than `int` are promoted to `int`, and `float` arguments are promoted to `double`
+        if (spec.argWidth || spec.argPrec) {
+            const char type = intArgType(sizes.intSize);
+            if (!type) {
+                return false;
+            }
+            types->append(spec.argWidth + spec.argPrec, type);
+        }
+        char type = 0;
+        switch (spec.conv) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c': {
+            switch (spec.length) {
+            case NO_LENGTH:
+            case LENGTH_HH:
+            case LENGTH_H:
+                type = intArgType(sizes.intSize);
+                break;
+            case LENGTH_L:
+                // `wint_t` is not smaller than `int` on the supported platforms
+                type = (spec.conv == 'c') ? intArgType(sizes.intSize) : intArgType(sizes.longSize);
+                break;
+            case LENGTH_LL:
+            case LENGTH_J:
+                type = intArgType(sizes.longLongSize);
+                break;
+            case LENGTH_Z:
+            case LENGTH_T:
+                type = intArgType(sizes.sizeTypeSize);
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            const unsigned size = (spec.length == LENGTH_BIG_L) ? sizes.longDoubleSize : sizes.doubleSize;
+            type = (size == 32) ? ARG_FLOAT32 : (size == 64) ? ARG_FLOAT64 : ARG_LONG_DOUBLE;
+            break;
+        }
+        case 's': {
+            if (spec.length == NO_LENGTH) {
+                type = ARG_CSTRING; // Wide strings are not supported
+            }
+            break;
+        }
+        case 'p':
+        case 'n': {
+            type = ARG_POINTER;
+            break;
+        }
+        default:
+            break;
+        }
+        if (!type) {
+            return false;
+        }
+        types->push_back(type);
+    }
+    return true;
+}
+
+void FmtParser::parseSpecs() {
     // printf() format strings can be parsed by a regex, but let's make it in a more readable way
-    const char* s = fmt.data();
+    const char* const fmt = fmt_.data();
+    const char* const end = fmt + fmt_.size();
+    const char* s = fmt;
     char c = 0;
-    while ((c = *s) != '\0') {
-        if (c != '%') {
-            ++s;
-            continue;
-        }
+    while ((s = (const char*)memchr(s, '%', end - s))) {
         const char* const spec = s; // Beginning of the format specifier
         ++s;
         c = next(s);
@@ -67,10 +174,12 @@ void FmtParser::parse(const std::string& fmt) {
             c = next(s);
         }
         // Field width (optional)
+        bool argWidth = false, argPrec = false;
         if (c == '*') {
+            argWidth = true;
             c = next(s);
         } else {
-            while (std::isdigit(c)) {
+            while (isDigit(c)) {
                 c = next(s);
             }
         }
@@ -78,41 +187,44 @@ void FmtParser::parse(const std::string& fmt) {
         if (c == '.') {
             c = next(s);
             if (c == '*') {
+                argPrec = true;
                 c = next(s);
             } else {
-                while (std::isdigit(c)) {
+                while (isDigit(c)) {
                     c = next(s);
                 }
             }
         }
         // Length modifier (optional)
+        Length length = NO_LENGTH;
         if (c == 'h') {
+            length = LENGTH_H;
             c = next(s);
             if (c == 'h') { // hh
+                length = LENGTH_HH;
                 c = next(s);
             }
         } else if (c == 'l') {
+            length = LENGTH_L;
             c = next(s);
             if (c == 'l') { // ll
+                length = LENGTH_LL;
                 c = next(s);
             }
         } else if (isOneOf(c, "jztL")) {
+            length = (c == 'j') ? LENGTH_J : (c == 'z') ? LENGTH_Z : (c == 't') ? LENGTH_T : LENGTH_BIG_L;
             c = next(s);
         }
         // Conversion specifier
         if (c == '%' && s - spec == 2) { // %%
             continue;
         }
-        if (!isOneOf(c, "csdioxXufFeEaAgGnp")) {
+        if (c == '\0' || !isOneOf(c, "csdioxXufFeEaAgGnp")) {
+            specs_.clear();
             throw ParsingError();
         }
-        specs.push_back(std::string(spec, s - spec));
+        specs_.push_back(Spec{ (size_t)(spec - fmt), (size_t)(s - spec), length, c, argWidth, argPrec });
     }
-    specs_.swap(specs);
-}
-
-std::string FmtParser::joinSpecs(const std::string& sep) const {
-    return boost::join(specs_, sep);
 }
 
 } // namespace particle
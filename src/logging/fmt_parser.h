@@ -24,10 +24,51 @@
 
 namespace particle {
 
-// Parser for printf() format strings
+// Type codes of the format arguments. A string of type codes, one per argument, can be passed to a logging
+// function instead of the format specifiers. The codes don't depend on the signedness of the arguments
+enum ArgType {
+    ARG_INT16 = 0x01,
+    ARG_INT32 = 0x02,
+    ARG_INT64 = 0x03,
+    ARG_FLOAT32 = 0x04,
+    ARG_FLOAT64 = 0x05,
+    ARG_LONG_DOUBLE = 0x06, // Floating point type of other size
+    ARG_CSTRING = 0x07, // Null-terminated string
+    ARG_POINTER = 0x08
+};
+
+// Parser for printf() format strings. The parser keeps its buffers between the calls to parse(), so an instance
+// can be reused to parse many format strings without allocating memory
 class FmtParser {
 public:
-    typedef std::vector<std::string> Specs;
+    // Length modifier
+    enum Length {
+        NO_LENGTH,
+        LENGTH_HH,
+        LENGTH_H,
+        LENGTH_L,
+        LENGTH_LL,
+        LENGTH_J,
+        LENGTH_Z,
+        LENGTH_T,
+        LENGTH_BIG_L
+    };
+
+    // Format specifier, referenced by its position in the format string
+    struct Spec {
+        size_t pos, size;
+        Length length;
+        char conv; // Conversion specifier
+        bool argWidth, argPrec; // Set if the field width or precision is passed as an argument
+    };
+
+    typedef std::vector<Spec> Specs;
+
+    // Sizes of the standard types of the target platform in bits. `intmax_t` is assumed to have the size of
+    // `long long`, and `ptrdiff_t` the size of `size_t`
+    struct TypeSizes {
+        unsigned intSize, longSize, longLongSize, sizeTypeSize, doubleSize, longDoubleSize;
+    };
 
     class ParsingError;
 
@@ -36,8 +77,12 @@ public:
 
     void parse(const std::string& fmt);
 
+    // Returns the format string
+    const std::string& fmt() const;
+
     // Returns all format specifiers of the format string
     const Specs& specs() const;
+    std::string spec(const Spec& spec) const;
 
     // Join all format specifiers into a single string
     std::string joinSpecs(const std::string& sep) const;
@@ -45,8 +90,15 @@ public:
 
     bool hasSpecs() const;
 
+    // Converts the format specifiers to a string of argument type codes. Returns false if some of the
+    // arguments can't be represented by a type code
+    bool argTypes(const TypeSizes& sizes, std::string* types) const;
+
 private:
+    std::string fmt_;
     Specs specs_;
+
+    void parseSpecs();
 };
 
 class FmtParser::ParsingError: public Error {
@@ -64,10 +116,18 @@ inline FmtParser::FmtParser(const std::string& fmt) {
     parse(fmt);
 }
 
+inline const std::string& FmtParser::fmt() const {
+    return fmt_;
+}
+
 inline const FmtParser::Specs& FmtParser::specs() const {
     return specs_;
 }
 
+inline std::string FmtParser::spec(const Spec& spec) const {
+    return fmt_.substr(spec.pos, spec.size);
+}
+
 inline std::string FmtParser::joinSpecs(char sep) const {
     return joinSpecs(std::string(1, sep));
 }
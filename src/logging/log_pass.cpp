@@ -17,11 +17,17 @@
 
 #include "logging/log_pass.h"
 
-#include "logging/attr_parser.h"
-#include "logging/fmt_parser.h"
+#include "logging/log_summary_pass.h"
 #include "plugin/gimple.h"
 #include "debug.h"
 
+#include <gimplify.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <unordered_set>
+#include <algorithm>
+
 namespace {
 
 using namespace particle;
@@ -59,6 +65,11 @@ tree buildComponentRef(tree ref, tree field) {
     return ref;
 }
 
+// Returns an attribute value, or none if the attribute is not specified
+boost::optional<std::string> optionalAttr(const std::string& val) {
+    return !val.empty() ? boost::make_optional(val) : boost::none;
+}
+
 // Returns field declaration for given structure type and field name
 tree findFieldDecl(tree structType, const std::string& fieldName) {
     for (tree field = TYPE_FIELDS(structType); field != NULL_TREE; field = TREE_CHAIN(field)) {
@@ -81,21 +92,118 @@ tree findFieldDecl(tree structType, const std::string& fieldName) {
 } // namespace
 
 particle::LogPass::LogPass(gcc::context* ctx, const PluginArgs& args) :
-        Pass<BaseType>(LOG_PASS_DATA, ctx) {
+        Pass<BaseType>(LOG_PASS_DATA, ctx),
+        typeSizes_(),
+        linkMsgIds_(false),
+        msgIdSymbols_(false),
+        frozenWarn_(false),
+        fmtArgTypes_(false),
+        inlineArgs_(false) {
+    // Pass argument type codes instead of the format specifiers to the logging functions (optional)
+    auto it = args.find("fmt-arg-types");
+    if (it != args.end()) {
+        fmtArgTypes_ = true;
+    }
+    // Serialize the arguments of the logging statements at the call sites (optional). The commit functions
+    // decode the arguments using the type codes
+    it = args.find("fmt-inline-args");
+    if (it != args.end()) {
+        fmtArgTypes_ = true;
+        inlineArgs_ = true;
+    }
+    // Assign message IDs at link time (optional)
+    it = args.find("msg-link-ids");
+    if (it != args.end()) {
+        if (flag_pic) { // Absolute symbols can't be referenced directly in position-independent code
+            throw Error("Link-time message IDs are not supported for position-independent code");
+        }
+        linkMsgIds_ = true;
+        return; // Message files are not used in this mode
+    }
+    // Collect messages without assigning IDs (optional)
+    it = args.find("msg-prewarm");
+    if (it != args.end()) {
+        prewarmFile_ = it->second.toString();
+        if (prewarmFile_.empty()) {
+            throw Error("Invalid manifest file name");
+        }
+        return;
+    }
     // Destination message file
     std::string destMsgFile;
-    auto it = args.find("dest-msg-file");
+    it = args.find("dest-msg-file");
     if (it != args.end()) {
         destMsgFile = it->second.toString();
     }
     if (!destMsgFile.empty()) {
-        // Source message files (optional)
+        // Source message files (optional). Multiple files are separated by colons
         std::vector<std::string> srcMsgFiles;
         it = args.find("src-msg-file");
         if (it != args.end()) {
-            srcMsgFiles.push_back(it->second.toString());
+            const std::string files = it->second.toString();
+            boost::split(srcMsgFiles, files, boost::is_any_of(":"));
+            srcMsgFiles.erase(std::remove(srcMsgFiles.begin(), srcMsgFiles.end(), std::string()), srcMsgFiles.end());
         }
         msgIndex_.reset(new MsgIndex(destMsgFile, srcMsgFiles));
+        // Storage backend of the message index (optional)
+        it = args.find("msg-index-backend");
+        if (it != args.end()) {
+            msgIndex_->backend(it->second.toString());
+        }
+        // Append new messages to the journal (optional)
+        it = args.find("msg-journal");
+        if (it != args.end()) {
+            msgIndex_->journalMode(true);
+        }
+        // Derive message IDs from message hashes (optional)
+        it = args.find("msg-id-hash");
+        if (it != args.end()) {
+            const int bits = it->second.isNone() ? 31 : fromStr<int>(it->second.toString(), 0);
+            if (bits < 8 || bits > 31) { // Message IDs are stored as signed integers in the message files
+                throw Error("Invalid size of the message ID hash: %s", it->second.toString());
+            }
+            msgIndex_->hashMode(bits);
+        }
+        // Number of shard files if the destination path is a directory (optional)
+        it = args.find("msg-index-shards");
+        if (it != args.end()) {
+            const int count = fromStr<int>(it->second.toString(), 0);
+            if (count < 1 || count > 1024) {
+                throw Error("Invalid number of shards: %s", it->second.toString());
+            }
+            msgIndex_->shardCount(count);
+        }
+        // Use the destination message file in read-only mode (optional)
+        it = args.find("msg-index-frozen");
+        if (it != args.end()) {
+            const std::string mode = it->second.isNone() ? "error" : it->second.toString();
+            if (mode != "error" && mode != "warn") {
+                throw Error("Invalid value of the `msg-index-frozen` argument: %s", mode);
+            }
+            msgIndex_->frozenMode(true);
+            frozenWarn_ = (mode == "warn");
+        }
+        // Shared memory segment caching the destination file (optional)
+        it = args.find("msg-shm");
+        if (it != args.end()) {
+            int msgCount = 0;
+            const auto sizeIt = args.find("msg-shm-size");
+            if (sizeIt != args.end()) {
+                msgCount = fromStr<int>(sizeIt->second.toString(), 0);
+                if (msgCount < 1024 || msgCount > 4 * 1024 * 1024) {
+                    throw Error("Invalid size of the shared memory segment: %s", sizeIt->second.toString());
+                }
+            }
+            msgIndex_->sharedMemory(it->second.toString(), msgCount);
+        }
+        // Message server socket (optional)
+        it = args.find("msg-server");
+        if (it != args.end()) {
+            msgIndex_->serverSocket(it->second.toString());
+        }
+        // Assign message IDs at link time when compiling with LTO
+        summaryPass_.reset(new LogSummaryPass(ctx, msgIndex_.get()));
+        summaryPass_->frozenWarn(frozenWarn_);
     }
 }
 
@@ -104,17 +212,61 @@ particle::LogPass::~LogPass() {
 
 unsigned particle::LogPass::execute(function*) {
     try {
+        // Message IDs are represented by symbols if they get assigned at link time
+        msgIdSymbols_ = (linkMsgIds_ || (summaryPass_ && LogSummaryPass::isStreamingMode()));
+        if (fmtArgTypes_) {
+            typeSizes_.intSize = TYPE_PRECISION(integer_type_node);
+            typeSizes_.longSize = TYPE_PRECISION(long_integer_type_node);
+            typeSizes_.longLongSize = TYPE_PRECISION(long_long_integer_type_node);
+            typeSizes_.sizeTypeSize = TYPE_PRECISION(size_type_node);
+            typeSizes_.doubleSize = TYPE_PRECISION(double_type_node);
+            typeSizes_.longDoubleSize = TYPE_PRECISION(long_double_type_node);
+        }
+        if (inlineArgs_) {
+            for (auto& f: logFuncs_) {
+                const auto it = commitFuncs_.find(declName(f.second.fnDecl));
+                if (it != commitFuncs_.end()) {
+                    initCommitDecl(&f.second, it->second);
+                }
+            }
+        }
         // Collect all log messages
         LogMsgList msgList;
-        cgraph_node* node = nullptr;
-        FOR_EACH_DEFINED_FUNCTION(node) {
-            function* const fn = node->get_fun();
-            if (fn) {
-                processFunc(fn, &msgList);
+        // Only the functions calling the logging functions need to be processed
+        std::unordered_set<cgraph_node*> callers;
+        for (const auto& f: logFuncs_) {
+            cgraph_node* const node = cgraph_node::get(f.second.fnDecl);
+            if (node) {
+                for (cgraph_edge* e = node->callers; e; e = e->next_caller) {
+                    callers.insert(e->caller);
+                }
             }
         }
-        // Update message IDs
-        updateMsgIds(&msgList);
+        if (!callers.empty()) {
+            // Iterate over the defined functions to keep the order of the messages stable
+            cgraph_node* node = nullptr;
+            FOR_EACH_DEFINED_FUNCTION(node) {
+                if (callers.count(node)) {
+                    processFunc(node, &msgList);
+                }
+            }
+        }
+        if (linkMsgIds_) {
+            // Embed the manifest into the object file
+            const ManifestWriter manifest = makeManifest(msgList);
+            if (!manifest.isEmpty()) {
+                const std::string asmStr = manifest.asmStr();
+                symtab->finalize_toplevel_asm(build_string(asmStr.size(), asmStr.data()));
+            }
+        } else if (msgIdSymbols_) {
+            // Stream the messages into the LTO object file
+            summaryPass_->addMsgs(makeManifest(msgList));
+        } else if (!prewarmFile_.empty()) {
+            // Message IDs will be assigned for all translation units at once by particle_msg_tool
+            makeManifest(msgList).appendToFile(prewarmFile_);
+        } else {
+            updateMsgIds(&msgList);
+        }
     } catch (const PassError& e) {
         error(e.location(), e.message());
     } catch (const Error& e) {
@@ -123,20 +275,33 @@ unsigned particle::LogPass::execute(function*) {
         // Include plugin name for better readability
         error("%s: %s", PluginBase::instance()->pluginName(), e.what());
     }
+    fmtSpecLits_.clear(); // Not needed anymore
+    fmtSpecs_.clear();
+    strs_.clear();
+    attrParser_.clearCache();
     return 0; // No additional TODOs
 }
 
 bool particle::LogPass::gate(function*) {
     // Run this pass only if current translation unit has logging functions declared
-    return (msgIndex_ && !logFuncs_.empty());
+    return ((msgIndex_ || linkMsgIds_ || !prewarmFile_.empty()) && !logFuncs_.empty());
 }
 
 opt_pass* particle::LogPass::clone() {
     return this; // FIXME?
 }
 
+void particle::LogPass::beginUnit() {
+    // The message file is loaded while the translation unit is being parsed. The IDs are assigned at compile time
+    // only if the messages are not streamed into the LTO object file, and only during WPA with LTO
+    if (msgIndex_ && !linkMsgIds_ && prewarmFile_.empty() && !(summaryPass_ && LogSummaryPass::isStreamingMode()) &&
+            !flag_ltrans) {
+        msgIndex_->preload();
+    }
+}
+
 void particle::LogPass::attrHandler(tree t, const std::string& name, std::vector<Variant> args) {
-    if (name != "log_function") {
+    if (name != "log_function" && name != "log_commit_function") {
         throw Error("Invalid attribute argument: \"%s\"", name);
     }
     if (TREE_CODE(t) != FUNCTION_DECL) {
@@ -145,6 +310,15 @@ void particle::LogPass::attrHandler(tree t, const std::string& name, std::vector
     if (args.size() != 1) {
         throw Error("Invalid number of attribute arguments");
     }
+    if (name == "log_commit_function") {
+        // The argument is the name of the logging function
+        const std::string logFuncName = args.at(0).toString();
+        if (logFuncName.empty()) {
+            throw Error("Invalid name of the logging function");
+        }
+        commitFuncs_[logFuncName] = t;
+        return;
+    }
     const int fmtArgIndex = args.at(0).toInt() - 1; // Convert to 0-based index
     if (fmtArgIndex < 0) {
         throw Error("Invalid index of the format string argument");
@@ -152,17 +326,25 @@ void particle::LogPass::attrHandler(tree t, const std::string& name, std::vector
     logFuncs_[DECL_UID(t)] = makeLogFunc(t, fmtArgIndex);
 }
 
-void particle::LogPass::processFunc(function* fn, LogMsgList* msgList) {
-    assert(fn);
-    if (fn->cfg) { // Ensure that the function has a control flow graph
-        // Iterate over all GIMPLE statements in all basic blocks
-        basic_block bb = nullptr;
-        FOR_ALL_BB_FN(bb, fn) {
-            for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
-                processStmt(gsi, msgList);
-            }
+void particle::LogPass::processFunc(cgraph_node* node, LogMsgList* msgList) {
+    assert(node);
+    function* const fn = node->get_fun();
+    if (!fn || !fn->cfg) { // Ensure that the function has a control flow graph
+        return;
+    }
+    // Collect the calls of the logging functions. The call edges are listed in the reverse order of the
+    // statements
+    std::vector<gimple> stmts;
+    for (cgraph_edge* e = node->callees; e; e = e->next_callee) {
+        if (e->call_stmt && logFuncs_.count(DECL_UID(e->callee->decl))) {
+            stmts.push_back(e->call_stmt);
         }
     }
+    push_cfun(fn); // Temporary variables are created in the context of the current function
+    for (auto it = stmts.rbegin(); it != stmts.rend(); ++it) {
+        processStmt(gsi_for_stmt(*it), msgList);
+    }
+    pop_cfun();
 }
 
 void particle::LogPass::processStmt(gimple_stmt_iterator gsi, LogMsgList* msgList) {
@@ -198,7 +380,7 @@ void particle::LogPass::processStmt(gimple_stmt_iterator gsi, LogMsgList* msgLis
     if (TREE_CODE(fmt) != STRING_CST) {
         return; // Not a string constant
     }
-    const std::string fmtStr = constStrVal(fmt);
+    const std::string& fmtStr = strs_.add(constStrVal(fmt));
     if (fmtStr.empty()) {
         return; // Skip empty message
     }
@@ -212,33 +394,68 @@ void particle::LogPass::processStmt(gimple_stmt_iterator gsi, LogMsgList* msgLis
     if (TREE_CODE(attr) != VAR_DECL) {
         return;
     }
-    // Parse format string
-    FmtParser fmtParser;
-    try {
-        fmtParser.parse(fmtStr);
-    } catch (const FmtParser::ParsingError& e) {
+    // Parse format string. The same format string is often used by many logging statements, so the parsing
+    // results are cached
+    auto fmtSpecIt = fmtSpecs_.find(&fmtStr);
+    if (fmtSpecIt == fmtSpecs_.end()) {
+        const std::string* fmtSpecStr = nullptr;
+        try {
+            fmtParser_.parse(fmtStr);
+            DEBUG("%s: Log message: \"%s\" -> \"%s\"", stmtLoc.str(), fmtStr, fmtParser_.hasSpecs() ?
+                    fmtParser_.joinSpecs(' ') : "NULL");
+            std::string s;
+            // The type codes can be distinguished from the format specifiers, which start with '%'
+            if (!fmtArgTypes_ || !fmtParser_.argTypes(typeSizes_, &s)) {
+                s = fmtParser_.joinSpecs(FMT_SPEC_SEP);
+            }
+            fmtSpecStr = &strs_.add(std::move(s));
+        } catch (const FmtParser::ParsingError&) {
+        }
+        fmtSpecIt = fmtSpecs_.insert(std::make_pair(&fmtStr, fmtSpecStr)).first;
+    }
+    if (!fmtSpecIt->second) {
         warning(stmtLoc, "Invalid format string: \"%s\"", fmtStr);
         return;
     }
-    DEBUG("%s: Log message: \"%s\" -> \"%s\"", stmtLoc.str(), fmtStr, fmtParser.hasSpecs() ? fmtParser.joinSpecs(' ') : "NULL");
+    const std::string& fmtSpecStr = *fmtSpecIt->second;
     // Parse additional attributes
-    AttrParser attrParser;
     try {
-        attrParser.parse(stmtLoc);
+        attrParser_.parse(stmtLoc);
     } catch (const AttrParser::ParsingError& e) {
         warning(stmtLoc, e.message());
     }
     // Replace format string argument
-    const std::string fmtSpecStr = fmtParser.joinSpecs(FMT_SPEC_SEP);
     if (!fmtSpecStr.empty()) {
-        fmt = build_string_literal(fmtSpecStr.size() + 1, fmtSpecStr.data()); // Length includes term. null
+        // Statements with the same format specifiers share a single string constant. String constants are
+        // emitted into mergeable sections, so that the linker can merge them across translation units
+        tree& lit = fmtSpecLits_[&fmtSpecStr];
+        if (lit == NULL_TREE) {
+            lit = build_string_literal(fmtSpecStr.size() + 1, fmtSpecStr.data()); // Length includes term. null
+        }
+        fmt = unshare_expr(lit);
     } else {
         fmt = null_pointer_node; // Set format string to NULL
     }
     gimple_call_set_arg(stmt, logFunc.fmtArgIndex, fmt);
     // Set `LogAttributes::id` field
     tree lhs = buildComponentRef(attr, logFunc.idFieldDecl);
-    tree rhs = build_int_cst(unsigned_type_node, INVALID_MSG_ID); // Placeholder for a message ID value
+    tree rhs = NULL_TREE;
+    if (msgIdSymbols_) {
+        // Message ID is the address of a symbol, which is defined at link time
+        if (attrParser_.msgId() != INVALID_MSG_ID) {
+            warning(stmtLoc, "Explicit message ID is ignored when message IDs are assigned at link time");
+        }
+        const std::string symbol = msgIdSymbol(fmtStr, optionalAttr(attrParser_.hintMsg()),
+                optionalAttr(attrParser_.helpId()));
+        rhs = create_tmp_var(unsigned_type_node, "msg_id");
+        const tree decl = msgIdDecl(symbol);
+        gimple assignAddr = gimple_build_assign(rhs, NOP_EXPR, build_fold_addr_expr(decl));
+        gsi_insert_before(&gsi, assignAddr, GSI_SAME_STMT);
+        // The callgraph is already built at this point, so the reference needs to be recorded explicitly
+        cgraph_node::get(current_function_decl)->create_reference(varpool_node::get(decl), IPA_REF_ADDR, assignAddr);
+    } else {
+        rhs = build_int_cst(unsigned_type_node, INVALID_MSG_ID); // Placeholder for a message ID value
+    }
     gimple assignId = gimple_build_assign(lhs, rhs);
     gsi_insert_before(&gsi, assignId, GSI_SAME_STMT);
     // Set `LogAttributes::has_id` field
@@ -246,16 +463,108 @@ void particle::LogPass::processStmt(gimple_stmt_iterator gsi, LogMsgList* msgLis
     rhs = build_int_cst(integer_type_node, 1);
     gimple assignHasId = gimple_build_assign(lhs, rhs);
     gsi_insert_before(&gsi, assignHasId, GSI_SAME_STMT);
+    // Serialize the arguments at the call site if they are described by type codes
+    if (logFunc.commitFnDecl != NULL_TREE && (fmtSpecStr.empty() || fmtSpecStr.front() != '%') &&
+            !inlineArgs(&gsi, logFunc, fmtSpecStr)) {
+        // The statement keeps calling the logging function, which receives the type codes instead
+        DEBUG("%s:%d: Arguments are not serialized inline", stmtLoc.file(), stmtLoc.line());
+        assert(gsi_stmt(gsi) == stmt && gimple_call_fndecl(stmt) == logFunc.fnDecl);
+    }
     // Add message to list
-    LogMsg msg;
-    msg.fmt = fmtStr;
+    assert(msgList);
+    msgList->push_back(LogMsg());
+    LogMsg& msg = msgList->back();
+    msg.fmt = &fmtStr;
     msg.assignIdStmt = assignId;
     msg.logStmtLoc = stmtLoc;
-    msg.id = attrParser.msgId();
-    msg.hintAttr = attrParser.hintMsg();
-    msg.helpIdAttr = attrParser.helpId();
-    assert(msgList);
-    msgList->push_back(std::move(msg));
+    msg.id = attrParser_.msgId();
+    msg.hintAttr = &strs_.add(attrParser_.hintMsg());
+    msg.helpIdAttr = &strs_.add(attrParser_.helpId());
+}
+
+bool particle::LogPass::inlineArgs(gimple_stmt_iterator* gsi, const LogFunc& logFunc, const std::string& argTypes) {
+    assert(gsi);
+    gimple stmt = gsi_stmt(*gsi);
+    if (gimple_call_lhs(stmt) != NULL_TREE) {
+        return false; // Result of the logging function is used
+    }
+    const unsigned argCount = gimple_call_num_args(stmt);
+    if (argCount - logFunc.namedArgCount != argTypes.size()) {
+        return false; // Format string doesn't match the arguments
+    }
+    // The arguments are written one after another, without padding
+    const unsigned ptrSize = int_size_in_bytes(ptr_type_node);
+    size_t bufSize = 0;
+    for (unsigned i = 0; i < argTypes.size(); ++i) {
+        const tree type = TREE_TYPE(gimple_call_arg(stmt, logFunc.namedArgCount + i));
+        bool isFloat = false;
+        size_t size = 0;
+        switch (argTypes.at(i)) {
+        case ARG_INT16: // Only produced on targets where `int` is 16-bit, such as AVR
+            size = 2;
+            break;
+        case ARG_INT32:
+            size = 4;
+            break;
+        case ARG_INT64:
+            size = 8;
+            break;
+        case ARG_FLOAT32: // Only produced on targets where `double` is 32-bit, such as AVR
+            size = 4;
+            isFloat = true;
+            break;
+        case ARG_FLOAT64:
+            size = 8;
+            isFloat = true;
+            break;
+        case ARG_POINTER:
+            size = ptrSize;
+            break;
+        default:
+            return false; // Strings are not serialized inline
+        }
+        if (!(isFloat ? SCALAR_FLOAT_TYPE_P(type) : (INTEGRAL_TYPE_P(type) || POINTER_TYPE_P(type))) ||
+                int_size_in_bytes(type) != (HOST_WIDE_INT)size) {
+            // Argument type doesn't match the format specifier. Nothing has been inserted yet, so the statement
+            // is left unchanged
+            return false;
+        }
+        bufSize += size;
+    }
+    // Write the arguments to a buffer allocated on the stack of the calling function
+    tree bufAddr = null_pointer_node;
+    if (bufSize > 0) {
+        const tree buf = create_tmp_var(build_array_type_nelts(unsigned_char_type_node, bufSize), "log_args");
+        TREE_ADDRESSABLE(buf) = 1;
+        const tree offsType = build_pointer_type(char_type_node); // Accesses via `char*` alias any object
+        size_t offs = 0;
+        for (unsigned i = 0; i < argTypes.size(); ++i) {
+            const tree arg = gimple_call_arg(stmt, logFunc.namedArgCount + i);
+            const tree type = build_aligned_type(TREE_TYPE(arg), BITS_PER_UNIT);
+            const tree ref = build2(MEM_REF, type, build_fold_addr_expr(buf), build_int_cst(offsType, offs));
+            gsi_insert_before(gsi, gimple_build_assign(ref, arg), GSI_SAME_STMT);
+            offs += int_size_in_bytes(type);
+        }
+        bufAddr = build_fold_addr_expr(buf);
+    }
+    // Replace the logging function call with a call to the commit function
+    tree sizeArg = TYPE_ARG_TYPES(TREE_TYPE(logFunc.commitFnDecl));
+    for (unsigned i = 0; i <= logFunc.namedArgCount; ++i) {
+        sizeArg = TREE_CHAIN(sizeArg); // Skip the named arguments and the buffer pointer
+    }
+    auto_vec<tree> args;
+    args.reserve(logFunc.namedArgCount + 2);
+    for (unsigned i = 0; i < logFunc.namedArgCount; ++i) {
+        args.quick_push(gimple_call_arg(stmt, i));
+    }
+    args.quick_push(bufAddr);
+    args.quick_push(build_int_cst(TREE_VALUE(sizeArg), bufSize));
+    gcall* const call = gimple_build_call_vec(logFunc.commitFnDecl, args);
+    gimple_set_location(call, gimple_location(stmt));
+    gimple_set_block(call, gimple_block(stmt));
+    gsi_replace(gsi, call, false);
+    cgraph_update_edges_for_call_stmt(stmt, logFunc.fnDecl, call);
+    return true;
 }
 
 void particle::LogPass::updateMsgIds(LogMsgList* msgList) {
@@ -265,13 +574,48 @@ void particle::LogPass::updateMsgIds(LogMsgList* msgList) {
         msgIndex_->process(msgList->begin(), msgList->end());
         // Update logging statements with actual message ID values
         for (const LogMsg& msg: *msgList) {
-            assert(msg.id != INVALID_MSG_ID);
+            if (msg.id == INVALID_MSG_ID) { // Can happen only in the frozen mode
+                if (frozenWarn_) {
+                    warning(msg.logStmtLoc, "Message is not found in the message file: \"%s\"", *msg.fmt);
+                } else {
+                    error(msg.logStmtLoc, "Message is not found in the message file: \"%s\"", *msg.fmt);
+                }
+                continue; // Keep the placeholder value
+            }
             tree rhs = build_int_cst(unsigned_type_node, msg.id);
             gimple_assign_set_rhs1(msg.assignIdStmt, rhs);
         }
     }
 }
 
+particle::ManifestWriter particle::LogPass::makeManifest(const LogMsgList& msgList) const {
+    ManifestWriter manifest;
+    for (const LogMsg& msg: msgList) {
+        const boost::optional<std::string> hintMsg = optionalAttr(*msg.hintAttr);
+        const boost::optional<std::string> helpId = optionalAttr(*msg.helpIdAttr);
+        manifest.add(msgIdSymbol(*msg.fmt, hintMsg, helpId), *msg.fmt, hintMsg, helpId, msg.logStmtLoc.file(),
+                msg.logStmtLoc.line());
+    }
+    return manifest;
+}
+
+tree particle::LogPass::msgIdDecl(const std::string& symbol) {
+    auto it = msgIdDecls_.find(symbol);
+    if (it == msgIdDecls_.end()) {
+        // extern const char <symbol>[] __attribute__((visibility("hidden")))
+        tree decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier(symbol.data()), char_type_node);
+        TREE_PUBLIC(decl) = 1;
+        TREE_READONLY(decl) = 1;
+        DECL_EXTERNAL(decl) = 1;
+        DECL_ARTIFICIAL(decl) = 1;
+        DECL_VISIBILITY(decl) = VISIBILITY_HIDDEN;
+        DECL_VISIBILITY_SPECIFIED(decl) = 1;
+        varpool_node::get_create(decl);
+        it = msgIdDecls_.insert(std::make_pair(symbol, decl)).first;
+    }
+    return it->second;
+}
+
 particle::LogPass::LogFunc particle::LogPass::makeLogFunc(tree fnDecl, unsigned fmtArgIndex) {
     const Location loc = location(fnDecl);
     tree fmtType = NULL_TREE, attrType = NULL_TREE;
@@ -335,3 +679,30 @@ void particle::LogPass::initAttrDecls(LogFunc* logFunc) {
         throw PassError(loc, "`%s` type is missing `%s` field", LOG_ATTR_STRUCT, LOG_ATTR_HAS_ID_FIELD);
     }
 }
+
+void particle::LogPass::initCommitDecl(LogFunc* logFunc, tree commitFnDecl) {
+    assert(logFunc);
+    // The commit function takes the named arguments of the logging function, followed by a pointer to the
+    // serialized arguments and their size
+    const Location loc = location(commitFnDecl);
+    if (!stdarg_p(TREE_TYPE(logFunc->fnDecl))) {
+        throw PassError(loc, "Logging function doesn't take a variable number of arguments");
+    }
+    tree logArg = TYPE_ARG_TYPES(TREE_TYPE(logFunc->fnDecl));
+    tree commitArg = TYPE_ARG_TYPES(TREE_TYPE(commitFnDecl));
+    unsigned namedArgCount = 0;
+    for (; logArg != NULL_TREE; logArg = TREE_CHAIN(logArg), commitArg = TREE_CHAIN(commitArg), ++namedArgCount) {
+        if (commitArg == NULL_TREE ||
+                TYPE_MAIN_VARIANT(TREE_VALUE(logArg)) != TYPE_MAIN_VARIANT(TREE_VALUE(commitArg))) {
+            throw PassError(loc, "Commit function doesn't take the arguments of the logging function");
+        }
+    }
+    const tree bufArg = commitArg;
+    const tree sizeArg = (bufArg != NULL_TREE) ? TREE_CHAIN(bufArg) : NULL_TREE;
+    if (bufArg == NULL_TREE || !POINTER_TYPE_P(TREE_VALUE(bufArg)) || sizeArg == NULL_TREE ||
+            !INTEGRAL_TYPE_P(TREE_VALUE(sizeArg)) || TREE_CHAIN(sizeArg) != void_list_node) {
+        throw PassError(loc, "Commit function is expected to take a pointer to the arguments and their size");
+    }
+    logFunc->commitFnDecl = commitFnDecl;
+    logFunc->namedArgCount = namedArgCount;
+}
@@ -17,19 +17,26 @@
 
 #pragma once
 
+#include "logging/attr_parser.h"
+#include "logging/fmt_parser.h"
 #include "logging/msg_index.h"
+#include "logging/msg_manifest.h"
 #include "plugin/plugin_base.h"
 #include "plugin/pass.h"
 #include "plugin/tree.h"
 #include "plugin/gcc_defs.h"
+#include "util/string_pool.h"
 #include "util/variant.h"
 #include "common.h"
 
+#include <unordered_map>
 #include <map>
-#include <list>
+#include <deque>
 
 namespace particle {
 
+class LogSummaryPass;
+
 class LogPass: public Pass<simple_ipa_opt_pass> {
 public:
     LogPass(gcc::context* ctx, const PluginArgs& args);
@@ -42,31 +49,40 @@ public:
 
     // Called by the plugin instance
     void attrHandler(tree t, const std::string& name, std::vector<Variant> args);
+    void beginUnit();
+
+    // Returns the pass assigning message IDs at link time with LTO, or `nullptr` if the pass is not used
+    LogSummaryPass* summaryPass() const;
 
 private:
     // Logging function
     struct LogFunc {
-        tree fnDecl, idFieldDecl, hasIdFieldDecl, attrType;
-        unsigned fmtArgIndex, attrArgIndex;
+        tree fnDecl, idFieldDecl, hasIdFieldDecl, attrType, commitFnDecl;
+        unsigned fmtArgIndex, attrArgIndex, namedArgCount;
 
         LogFunc() :
                 fnDecl(NULL_TREE),
                 idFieldDecl(NULL_TREE),
                 hasIdFieldDecl(NULL_TREE),
                 attrType(NULL_TREE),
+                commitFnDecl(NULL_TREE),
                 fmtArgIndex(0),
-                attrArgIndex(0) {
+                attrArgIndex(0),
+                namedArgCount(0) {
         }
     };
 
-    // Log message
+    // Log message. The strings are interned in the string pool of the pass
     struct LogMsg: MsgIndex::Msg {
-        std::string fmt, hintAttr, helpIdAttr;
+        const std::string *fmt, *hintAttr, *helpIdAttr;
         gimple assignIdStmt;
         Location logStmtLoc;
         MsgId id;
 
         LogMsg() :
+                fmt(nullptr),
+                hintAttr(nullptr),
+                helpIdAttr(nullptr),
                 assignIdStmt(nullptr),
                 id(INVALID_MSG_ID) {
         }
@@ -80,16 +96,16 @@ private:
             return id;
         }
 
-        virtual std::string fmtStr() const override {
-            return fmt;
+        virtual const std::string& fmtStr() const override {
+            return *fmt;
         }
 
-        virtual std::string hintMsg() const override {
-            return hintAttr;
+        virtual const std::string& hintMsg() const override {
+            return *hintAttr;
         }
 
-        virtual std::string helpId() const override {
-            return helpIdAttr;
+        virtual const std::string& helpId() const override {
+            return *helpIdAttr;
         }
 
         virtual std::string srcFile() const override {
@@ -101,17 +117,41 @@ private:
         }
     };
 
-    typedef std::list<LogMsg> LogMsgList;
-
-    std::map<DeclUid, LogFunc> logFuncs_;
+    // Messages are allocated in blocks rather than one by one
+    typedef std::deque<LogMsg> LogMsgList;
+
+    std::unordered_map<DeclUid, LogFunc> logFuncs_;
+    std::unordered_map<std::string, tree> commitFuncs_; // Commit functions by names of the logging functions
+    StringPool strs_;
+    AttrParser attrParser_; // Caches the comment blocks of the source files
+    FmtParser fmtParser_;
+    // Joined format specifiers or argument type codes of the interned format strings, or null if a format
+    // string is invalid
+    std::unordered_map<const std::string*, const std::string*> fmtSpecs_;
+    // String literals of the interned format specifiers and type codes
+    std::unordered_map<const std::string*, tree> fmtSpecLits_;
+    std::map<std::string, tree> msgIdDecls_;
     std::unique_ptr<MsgIndex> msgIndex_;
+    std::unique_ptr<LogSummaryPass> summaryPass_;
+    std::string prewarmFile_;
+    FmtParser::TypeSizes typeSizes_;
+    bool linkMsgIds_, msgIdSymbols_, frozenWarn_, fmtArgTypes_, inlineArgs_;
 
-    void processFunc(function* fn, LogMsgList* msgList);
+    void processFunc(cgraph_node* node, LogMsgList* msgList);
     void processStmt(gimple_stmt_iterator gsi, LogMsgList* msgList);
+    bool inlineArgs(gimple_stmt_iterator* gsi, const LogFunc& logFunc, const std::string& argTypes);
     void updateMsgIds(LogMsgList* msgList);
+    ManifestWriter makeManifest(const LogMsgList& msgList) const;
+
+    tree msgIdDecl(const std::string& symbol);
 
     static LogFunc makeLogFunc(tree fnDecl, unsigned fmtArgIndex);
     static void initAttrDecls(LogFunc* logFunc);
+    static void initCommitDecl(LogFunc* logFunc, tree commitFnDecl);
 };
 
 } // namespace particle
+
+inline particle::LogSummaryPass* particle::LogPass::summaryPass() const {
+    return summaryPass_.get();
+}
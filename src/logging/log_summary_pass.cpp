@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/log_summary_pass.h"
+
+#include "logging/msg_index.h"
+#include "plugin/plugin_base.h"
+#include "util/string.h"
+#include "debug.h"
+
+#include <gimple-walk.h>
+#include <gimple-ssa.h>
+#include <lto-streamer.h>
+
+#include <unordered_set>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+using namespace particle;
+
+const pass_data LOG_SUMMARY_PASS_DATA = {
+    IPA_PASS, // type
+    "particle_log_summary", // name
+    OPTGROUP_NONE, // optinfo_flags
+    TV_NONE, // tv_id
+    0, // properties_required
+    0, // properties_provided
+    0, // properties_destroyed
+    0, // todo_flags_start
+    0 // todo_flags_finish
+};
+
+// Names of the LTO sections. The manifest section contains log messages of a translation unit (see
+// ManifestWriter), the ID section contains the message IDs assigned during WPA: <symbol>\0<ID>\0...
+const char* const LTO_MANIFEST_SECTION = "particle_msgs";
+const char* const LTO_MSG_IDS_SECTION = "particle_msg_ids";
+
+// Custom LTO sections are written with the function body section type, which is the only section type
+// allowing arbitrary section names
+void writeLtoSection(const char* name, const std::string& data) {
+    char* const sectName = lto_get_section_name(LTO_section_function_body, name, nullptr);
+    lto_begin_section(sectName, !flag_wpa); // WPA output is not compressed
+    free(sectName);
+    lto_write_data(data.data(), data.size());
+    lto_end_section();
+}
+
+// Reads contents of a section from all LTO object files
+std::vector<std::string> readLtoSections(const char* name) {
+    std::vector<std::string> sects;
+    lto_file_decl_data** const files = lto_get_file_decl_data();
+    for (unsigned i = 0; files[i]; ++i) {
+        size_t size = 0;
+        const char* const data = lto_get_section_data(files[i], LTO_section_function_body, name, &size);
+        if (data) {
+            sects.push_back(std::string(data, size));
+            lto_free_section_data(files[i], LTO_section_function_body, name, data, size);
+        }
+    }
+    return sects;
+}
+
+template<typename FuncT>
+void handleErrors(FuncT func) {
+    try {
+        func();
+    } catch (const std::exception& e) {
+        // Include plugin name for better readability
+        PluginBase::error("%s: %s", PluginBase::instance()->pluginName(), e.what());
+    }
+}
+
+} // namespace
+
+particle::LogSummaryPass* particle::LogSummaryPass::instance_ = nullptr;
+
+particle::LogSummaryPass::LogSummaryPass(gcc::context* ctx, MsgIndex* msgIndex) :
+        Pass<BaseType>(LOG_SUMMARY_PASS_DATA, ctx,
+                nullptr, // generate_summary
+                writeSummary, // write_summary
+                readSummary, // read_summary
+                writeOptSummary, // write_optimization_summary
+                readOptSummary, // read_optimization_summary
+                nullptr, // stmt_fixup
+                0, // function_transform_todo_flags_start
+                functionTransform, // function_transform
+                nullptr), // variable_transform
+        msgIndex_(msgIndex),
+        frozenWarn_(false) {
+    assert(msgIndex_);
+    instance_ = this;
+}
+
+particle::LogSummaryPass::~LogSummaryPass() {
+    instance_ = nullptr;
+}
+
+void particle::LogSummaryPass::addMsgs(const ManifestWriter& manifest) {
+    manifest_.append(manifest.data());
+}
+
+bool particle::LogSummaryPass::isStreamingMode() {
+    // Fat LTO objects can be linked without LTO, so the message IDs are assigned at compile time
+    return (flag_generate_lto && !flag_fat_lto_objects);
+}
+
+unsigned particle::LogSummaryPass::execute(function*) {
+    if (in_lto_p && !flag_ltrans) { // WPA or a non-partitioned link
+        handleErrors([this]() {
+            assignMsgIds();
+        });
+    }
+    return 0; // No additional TODOs
+}
+
+bool particle::LogSummaryPass::gate(function*) {
+    return (isStreamingMode() || in_lto_p);
+}
+
+opt_pass* particle::LogSummaryPass::clone() {
+    return this; // FIXME?
+}
+
+void particle::LogSummaryPass::assignMsgIds() {
+    // Messages referenced in the code that was removed by the optimizations don't get their IDs
+    std::unordered_set<std::string> symbols;
+    varpool_node* node = nullptr;
+    FOR_EACH_VARIABLE(node) {
+        ipa_ref* ref = nullptr;
+        if (DECL_EXTERNAL(node->decl) && DECL_NAME(node->decl) != NULL_TREE && node->iterate_referring(0, ref)) {
+            symbols.insert(IDENTIFIER_POINTER(DECL_NAME(node->decl)));
+        }
+    }
+    std::list<ManifestMsg> msgs;
+    for (const ManifestMsg& msg: msgs_.msgs()) {
+        if (symbols.count(msg.symbol)) {
+            msgs.push_back(msg);
+        }
+    }
+    DEBUG("Assigning message IDs: %u messages, %u unused", (unsigned)msgs.size(),
+            (unsigned)(msgs_.msgs().size() - msgs.size()));
+    if (!msgs.empty()) {
+        msgIndex_->process(msgs.begin(), msgs.end());
+    }
+    msgIds_.clear();
+    for (const ManifestMsg& msg: msgs) {
+        if (msg.id == INVALID_MSG_ID) { // Can happen only in the frozen mode
+            const std::string s = format("%s:%u: Message is not found in the message file: \"%s\"", msg.file,
+                    msg.line, msg.fmt);
+            if (!frozenWarn_) {
+                ::error("%s", s.data());
+                continue;
+            }
+            ::warning(0, "%s", s.data()); // The symbol is replaced with the placeholder value
+        }
+        msgIds_[msg.symbol] = msg.id;
+    }
+}
+
+unsigned particle::LogSummaryPass::transformFunc(cgraph_node* node) {
+    if (msgIds_.empty()) {
+        return 0;
+    }
+    function* const fn = DECL_STRUCT_FUNCTION(node->decl);
+    if (!fn || !fn->cfg) {
+        return 0;
+    }
+    walk_stmt_info wi;
+    memset(&wi, 0, sizeof(wi));
+    wi.info = this;
+    basic_block bb = nullptr;
+    FOR_EACH_BB_FN(bb, fn) {
+        for (gphi_iterator gsi = gsi_start_phis(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gphi* const phi = gsi.phi();
+            wi.changed = false;
+            for (unsigned i = 0; i < gimple_phi_num_args(phi); ++i) {
+                int walkSubtrees = 0;
+                replaceMsgIdRef(gimple_phi_arg_def_ptr(phi, i), &walkSubtrees, &wi);
+            }
+            if (wi.changed) {
+                node->remove_stmt_references(phi);
+            }
+        }
+        for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+            gimple stmt = gsi_stmt(gsi);
+            wi.changed = false;
+            walk_gimple_op(stmt, replaceMsgIdRef, &wi);
+            if (wi.changed) {
+                update_stmt(stmt);
+                node->remove_stmt_references(stmt);
+            }
+        }
+    }
+    return 0; // No additional TODOs
+}
+
+void particle::LogSummaryPass::writeSummary() {
+    assert(instance_);
+    // Stream the messages of the current translation unit
+    if (!instance_->manifest_.empty()) {
+        writeLtoSection(LTO_MANIFEST_SECTION, instance_->manifest_);
+    }
+}
+
+void particle::LogSummaryPass::readSummary() {
+    assert(instance_);
+    handleErrors([]() {
+        for (const std::string& data: readLtoSections(LTO_MANIFEST_SECTION)) {
+            instance_->msgs_.parse(data);
+        }
+    });
+}
+
+void particle::LogSummaryPass::writeOptSummary() {
+    assert(instance_);
+    // Stream the message IDs for the LTRANS stage
+    std::string data;
+    for (const auto& msg: instance_->msgIds_) {
+        data.append(msg.first.data(), msg.first.size() + 1); // Include term. null
+        const std::string id = toStr(msg.second);
+        data.append(id.data(), id.size() + 1);
+    }
+    if (!data.empty()) {
+        writeLtoSection(LTO_MSG_IDS_SECTION, data);
+    }
+}
+
+void particle::LogSummaryPass::readOptSummary() {
+    assert(instance_);
+    handleErrors([]() {
+        for (const std::string& data: readLtoSections(LTO_MSG_IDS_SECTION)) {
+            size_t pos = 0;
+            while (pos < data.size()) {
+                const size_t symEnd = data.find('\0', pos);
+                const size_t idEnd = (symEnd != std::string::npos) ? data.find('\0', symEnd + 1) : std::string::npos;
+                if (idEnd == std::string::npos) {
+                    throw Error("Invalid format of the LTO section: %s", LTO_MSG_IDS_SECTION);
+                }
+                instance_->msgIds_[data.substr(pos, symEnd - pos)] =
+                        fromStr<MsgId>(data.substr(symEnd + 1, idEnd - symEnd - 1));
+                pos = idEnd + 1;
+            }
+        }
+    });
+}
+
+unsigned particle::LogSummaryPass::functionTransform(cgraph_node* node) {
+    assert(instance_);
+    return instance_->transformFunc(node);
+}
+
+tree particle::LogSummaryPass::replaceMsgIdRef(tree* t, int* walkSubtrees, void* data) {
+    if (TREE_CODE(*t) != ADDR_EXPR) {
+        return NULL_TREE; // Continue walking
+    }
+    *walkSubtrees = 0;
+    const tree decl = TREE_OPERAND(*t, 0);
+    if (TREE_CODE(decl) != VAR_DECL || !DECL_EXTERNAL(decl) || DECL_NAME(decl) == NULL_TREE) {
+        return NULL_TREE;
+    }
+    walk_stmt_info* const wi = static_cast<walk_stmt_info*>(data);
+    const LogSummaryPass* const pass = static_cast<const LogSummaryPass*>(wi->info);
+    const auto it = pass->msgIds_.find(IDENTIFIER_POINTER(DECL_NAME(decl)));
+    if (it != pass->msgIds_.end()) {
+        // Replace the symbol address with the message ID value
+        *t = build_int_cst(TREE_TYPE(*t), it->second);
+        wi->changed = true;
+    }
+    return NULL_TREE;
+}
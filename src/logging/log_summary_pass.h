@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/msg_manifest.h"
+#include "plugin/pass.h"
+#include "plugin/gcc_defs.h"
+#include "common.h"
+
+#include <unordered_map>
+
+namespace particle {
+
+// IPA pass assigning message IDs once per link when the code is compiled with -flto. The log messages of each
+// translation unit are streamed into the LTO object file, the IDs are assigned during the whole program analysis
+// (WPA) for the messages that survived the optimizations, and then substituted in the function bodies during the
+// link-time transformation (LTRANS) stage
+class LogSummaryPass: public Pass<ipa_opt_pass_d> {
+public:
+    LogSummaryPass(gcc::context* ctx, MsgIndex* msgIndex);
+    virtual ~LogSummaryPass();
+
+    // Adds messages of the current translation unit
+    void addMsgs(const ManifestWriter& manifest);
+
+    // Report messages missing in the frozen message file as warnings rather than errors
+    void frozenWarn(bool enabled);
+
+    // Returns `true` if the messages of the current translation unit need to be streamed into the LTO object
+    // file instead of being assigned IDs at compile time
+    static bool isStreamingMode();
+
+    // Reimplemented from `opt_pass`
+    virtual unsigned execute(function* fn) override;
+    virtual bool gate(function* fn) override;
+    virtual opt_pass* clone() override;
+
+private:
+    std::string manifest_;
+    ManifestMsgList msgs_;
+    std::unordered_map<std::string, MsgId> msgIds_;
+    MsgIndex* msgIndex_;
+    bool frozenWarn_;
+
+    void assignMsgIds();
+    unsigned transformFunc(cgraph_node* node);
+
+    // Callbacks of the IPA pass
+    static void writeSummary();
+    static void readSummary();
+    static void writeOptSummary();
+    static void readOptSummary();
+    static unsigned functionTransform(cgraph_node* node);
+    static tree replaceMsgIdRef(tree* t, int* walkSubtrees, void* data);
+
+    static LogSummaryPass* instance_;
+};
+
+} // namespace particle
+
+inline void particle::LogSummaryPass::frozenWarn(bool enabled) {
+    frozenWarn_ = enabled;
+}
@@ -17,17 +17,37 @@
 
 #include "logging/msg_index.h"
 
+#include "logging/bin_index.h"
+#include "logging/shm_index.h"
+#include "logging/msg_server.h"
+#include "logging/msg_journal.h"
 #include "util/json.h"
+#include "util/hash.h"
+#include "util/string.h"
 #include "error.h"
 #include "debug.h"
 
 #include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
 
 #include <fstream>
 #include <sstream>
 #include <mutex>
-#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <climits>
+#include <cstring>
 #include <cctype>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace ipc = boost::interprocess;
 
@@ -42,6 +62,42 @@ const std::string JSON_HINT_MSG_ATTR = "hint";
 const std::string JSON_HELP_ID_ATTR = "help";
 const unsigned JSON_MSG_OBJ_LEVEL = 2;
 
+// Suffix of the binary index file that is maintained alongside the destination message file
+const std::string BIN_INDEX_FILE_SUFFIX = ".idx";
+
+// Suffix of the message journal file
+const std::string JOURNAL_FILE_SUFFIX = ".journal";
+
+// Suffix of the journal file being merged into the destination file
+const std::string OLD_JOURNAL_FILE_SUFFIX = ".old";
+
+// Name of the storage backend keeping the messages in the destination JSON file
+const std::string JSON_BACKEND = "json";
+
+// Maximum number of threads parsing the source message files
+const unsigned MAX_LOADER_THREAD_COUNT = 4;
+
+// Message files are parsed in chunks on multiple threads if they are large enough to produce at least two
+// chunks of this size
+const size_t MIN_PARSE_CHUNK_SIZE = 1024 * 1024;
+
+// Maximum number of threads parsing a single message file
+const unsigned MAX_PARSER_THREAD_COUNT = 4;
+
+// Number of messages looked up in the binary index at once
+const unsigned BIN_INDEX_LOOKUP_BATCH_SIZE = 16;
+
+// Default number of shard files
+const unsigned DEFAULT_SHARD_COUNT = 16;
+
+// Name of the file storing the number of shards in the destination directory
+const std::string SHARD_COUNT_FILE_NAME = "shards";
+
+// Returns name of a shard file in the destination directory
+std::string shardFileName(unsigned index) {
+    return "shard." + toStr(index) + ".json";
+}
+
 // Concatenates two serialized non-empty JSON arrays of message objects
 void appendJsonIndex(std::ostream* strm, const std::string& json) {
     auto p = json.find('{');
@@ -55,24 +111,205 @@ void appendJsonIndex(std::ostream* strm, const std::string& json) {
     strm->write(json.data() + p, json.size() - p);
 }
 
+// Splits a serialized JSON array of message objects into at most `count` chunks of consecutive elements. The array
+// is split at line breaks, which can't appear inside JSON strings, followed by an opening brace with the same
+// indentation as the first message object. Such a brace may still belong to a nested object, in which case the
+// adjacent chunks are not valid sequences of JSON values and fail to parse. Returns offsets and sizes of the chunks
+std::vector<std::pair<size_t, size_t>> splitMsgArray(const char* data, size_t size, unsigned count) {
+    std::vector<std::pair<size_t, size_t>> chunks;
+    const auto isSpace = [](char c) {
+        return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    };
+    size_t begin = 0, end = size;
+    while (begin < end && isSpace(data[begin])) {
+        ++begin;
+    }
+    while (end > begin && isSpace(data[end - 1])) {
+        --end;
+    }
+    if (end - begin < 2 || data[begin] != '[' || data[end - 1] != ']') {
+        return chunks;
+    }
+    ++begin;
+    --end;
+    while (begin < end && isSpace(data[begin])) {
+        ++begin;
+    }
+    while (end > begin && isSpace(data[end - 1])) {
+        --end;
+    }
+    if (begin == end || data[begin] != '{') {
+        return chunks;
+    }
+    size_t indent = begin;
+    while (indent > 0 && data[indent - 1] != '\n') {
+        --indent;
+    }
+    indent = begin - indent;
+    const size_t chunkSize = (end - begin) / count;
+    size_t chunkBegin = begin;
+    for (unsigned i = 1; i < count; ++i) {
+        size_t pos = std::max(chunkBegin, begin + i * chunkSize);
+        bool found = false;
+        while (!found && pos < end) {
+            const char* const lineEnd = static_cast<const char*>(std::memchr(data + pos, '\n', end - pos));
+            if (!lineEnd) {
+                break;
+            }
+            pos = lineEnd - data + 1;
+            size_t lineBegin = pos;
+            while (pos < end && isSpace(data[pos])) {
+                if (data[pos] == '\n') {
+                    lineBegin = pos + 1;
+                }
+                ++pos;
+            }
+            if (pos < end && data[pos] == '{' && pos - lineBegin == indent) {
+                // The previous element must be followed by a comma
+                size_t chunkEnd = lineEnd - data;
+                while (chunkEnd > chunkBegin && isSpace(data[chunkEnd - 1])) {
+                    --chunkEnd;
+                }
+                if (chunkEnd > chunkBegin && data[chunkEnd - 1] == ',') {
+                    chunks.push_back(std::make_pair(chunkBegin, chunkEnd - 1 - chunkBegin));
+                    chunkBegin = pos;
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+    chunks.push_back(std::make_pair(chunkBegin, end - chunkBegin));
+    return chunks;
+}
+
+// Descriptor of an open message file. Note that POSIX record locks, which are used by ipc::file_lock, are
+// released when any descriptor of the locked file is closed by the process, so a locked file is opened once and
+// its descriptor is closed only after the lock is released
+class FileDesc {
+public:
+    FileDesc(const fs::path& file, int flags) :
+            file_(file.string()),
+            fd_(::open(file_.data(), flags, 0666)) {
+        if (fd_ < 0) {
+            throw Error("Unable to open message file: %s: %s", file_, std::strerror(errno));
+        }
+    }
+
+    ~FileDesc() {
+        ::close(fd_);
+    }
+
+    // Writes data at the specified offset and truncates the file at the end of the written data
+    void write(uint64_t offs, const std::string& data) {
+        size_t pos = 0;
+        while (pos < data.size()) {
+            const ssize_t n = ::pwrite(fd_, data.data() + pos, data.size() - pos, offs + pos);
+            if (n < 0 && errno != EINTR) {
+                throw Error("Unable to write message file: %s: %s", file_, std::strerror(errno));
+            }
+            if (n > 0) {
+                pos += n;
+            }
+        }
+        if (::ftruncate(fd_, offs + data.size()) != 0) {
+            throw Error("Unable to truncate message file: %s: %s", file_, std::strerror(errno));
+        }
+    }
+
+    const std::string& file() const {
+        return file_;
+    }
+
+    int fd() const {
+        return fd_;
+    }
+
+private:
+    std::string file_;
+    int fd_;
+};
+
+// Read-only memory mapping of a message file. Message files are parsed in place rather than via a stream
+class MappedFile {
+public:
+    explicit MappedFile(const FileDesc& file) :
+            data_(nullptr),
+            size_(0) {
+        struct stat st = {};
+        if (::fstat(file.fd(), &st) != 0) {
+            throw Error("Unable to read message file: %s: %s", file.file(), std::strerror(errno));
+        }
+        if (st.st_size > 0) { // Empty files can't be mapped
+            void* const p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, file.fd(), 0);
+            if (p == MAP_FAILED) {
+                throw Error("Unable to read message file: %s: %s", file.file(), std::strerror(errno));
+            }
+            data_ = static_cast<const char*>(p);
+            size_ = st.st_size;
+        }
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
 } // namespace
 
 class MsgIndex::IndexReader: public JsonReader::Handler {
 public:
-    IndexReader(std::istream* strm, MsgDataMap* msgMap, MsgSrc msgSrc) :
+    IndexReader(const char* data, size_t size, MsgDataMap* msgMap, MsgSrc msgSrc) :
             msgMap_(msgMap),
-            strm_(strm),
+            data_(data),
+            size_(size),
+            reader_(nullptr),
             msgSrc_(msgSrc),
             state_(State::NEW),
             level_(0),
-            lastMsgEndPos_(-1),
+            lastMsgEndPos_(0),
             maxMsgId_(INVALID_MSG_ID),
-            msgCount_(0) {
+            msgCount_(0),
+            binWriter_(nullptr),
+            addMsgs_(false),
+            deferMsgs_(false) {
+    }
+
+    IndexReader(const MappedFile& file, MsgDataMap* msgMap, MsgSrc msgSrc) :
+            IndexReader(file.data(), file.size(), msgMap, msgSrc) {
+    }
+
+    // Sets the data to parse
+    void data(const char* data, size_t size) {
+        data_ = data;
+        size_ = size;
     }
 
     void parse() {
-        JsonReader reader(strm_, this);
+        // Source files are parsed in the deferred mode and concurrently with each other already
+        if (!deferMsgs_ && parseChunks()) {
+            return;
+        }
+        JsonReader reader(data_, size_, this);
+        reader_ = &reader;
         reader.parse();
+        reader_ = nullptr;
         // Reader remains in the NEW state in case of an empty file
         checkState(State::NEW | State::DONE);
     }
@@ -81,6 +318,7 @@ public:
         checkState(State::MSG_ARRAY | State::SKIP);
         if (state_ == State::MSG_ARRAY) {
             state_ = State::MSG_OBJ;
+            attrs_.clear();
         }
         ++level_;
     }
@@ -89,40 +327,23 @@ public:
         --level_;
         if (state_ == State::MSG_OBJ) {
             // ID and format string attributes are mandatory
-            if (!attrs_.msgId) {
+            if (!(attrs_.mask & Attrs::MSG_ID)) {
                 throw Error("Missing attribute: `%s`", JSON_MSG_ID_ATTR);
             }
-            const MsgId msgId = *attrs_.msgId;
-            if (!attrs_.fmtStr) {
+            if (!(attrs_.mask & Attrs::FMT_STR)) {
                 throw Error("Missing attribute: `%s`", JSON_FMT_STR_ATTR);
             }
-            // Check if there's a source message with the same attributes
-            MsgKey key;
-            key.fmtStr = *attrs_.fmtStr;
-            key.hintMsg = attrs_.hintMsg;
-            key.helpId = attrs_.helpId;
-            const auto it = msgMap_->find(key);
-            if (it != msgMap_->end()) {
-                MsgData& data = it->second;
-                if (data.id == INVALID_MSG_ID) {
-                    const auto r = foundMsgIds_.insert(msgId);
-                    if (!r.second) {
-                        throw Error("Duplicate message ID: %u", msgId);
-                    }
-                    data.id = msgId;
-                    assert(data.src == MsgSrc::NEW);
-                    data.src = msgSrc_;
-                    DEBUG("Found message: \"%s\", ID: %u", key.fmtStr, data.id);
-                } else if (data.id != msgId) {
-                    throw Error("Conflicting message, ID: %u", msgId);
-                }
-            }
-            if (maxMsgId_ == INVALID_MSG_ID || msgId > maxMsgId_) {
-                maxMsgId_ = msgId;
-            }
-            lastMsgEndPos_ = strm_->tellg();
+            // The attribute strings are reused for all messages, so that their buffers don't need to be
+            // reallocated for each message
+            attrs_.key.fmtStr.swap(attrs_.fmtStr);
+            setOptional(&attrs_.key.hintMsg, &attrs_.hintMsg, attrs_.mask & Attrs::HINT_MSG);
+            setOptional(&attrs_.key.helpId, &attrs_.helpId, attrs_.mask & Attrs::HELP_ID);
+            attrs_.key.updateHash();
+            processMsg(attrs_.msgId, attrs_.key);
+            attrs_.key.fmtStr.swap(attrs_.fmtStr);
+            assert(reader_);
+            lastMsgEndPos_ = reader_->pos();
             ++msgCount_;
-            attrs_ = Attrs();
             state_ = State::MSG_ARRAY;
         } else if (level_ == JSON_MSG_OBJ_LEVEL) {
             state_ = State::MSG_OBJ;
@@ -146,16 +367,17 @@ public:
         }
     }
 
-    virtual void name(std::string name) override {
+    virtual void rawName(const char* str, size_t size) override {
         checkState(State::MSG_OBJ | State::SKIP);
         if (state_ == State::MSG_OBJ) {
-            if (name == JSON_MSG_ID_ATTR) {
+            // Attribute names are compared in place
+            if (isEqual(JSON_MSG_ID_ATTR, str, size)) {
                 state_ = State::MSG_ID;
-            } else if (name == JSON_FMT_STR_ATTR) {
+            } else if (isEqual(JSON_FMT_STR_ATTR, str, size)) {
                 state_ = State::FMT_STR;
-            } else if (name == JSON_HINT_MSG_ATTR) {
+            } else if (isEqual(JSON_HINT_MSG_ATTR, str, size)) {
                 state_ = State::HINT_MSG;
-            } else if (name == JSON_HELP_ID_ATTR) {
+            } else if (isEqual(JSON_HELP_ID_ATTR, str, size)) {
                 state_ = State::HELP_ID;
             } else {
                 state_ = State::SKIP;
@@ -163,34 +385,94 @@ public:
         }
     }
 
-    virtual void value(Variant val) override {
+    virtual void rawString(const char* str, size_t size) override {
         checkState(State::MSG_ID | State::FMT_STR | State::HINT_MSG | State::HELP_ID | State::SKIP);
-        if (state_ == State::MSG_ID) {
-            checkInt(val, JSON_MSG_ID_ATTR);
-            const int msgId = val.toInt();
-            if (msgId < 0 || msgId == INVALID_MSG_ID) {
-                throw Error("Invalid message ID: %d", msgId);
-            }
-            attrs_.msgId = msgId;
-            state_ = State::MSG_OBJ;
-        } else if (state_ == State::FMT_STR) {
-            checkString(val, JSON_FMT_STR_ATTR);
-            attrs_.fmtStr = val.toString();
+        if (state_ == State::FMT_STR) {
+            attrs_.fmtStr.assign(str, size);
+            attrs_.mask |= Attrs::FMT_STR;
             state_ = State::MSG_OBJ;
         } else if (state_ == State::HINT_MSG) {
-            checkString(val, JSON_HINT_MSG_ATTR);
-            attrs_.hintMsg = val.toString();
+            attrs_.hintMsg.assign(str, size);
+            attrs_.mask |= Attrs::HINT_MSG;
             state_ = State::MSG_OBJ;
         } else if (state_ == State::HELP_ID) {
-            checkString(val, JSON_HELP_ID_ATTR);
-            attrs_.helpId = val.toString();
-            state_ = State::MSG_OBJ;
-        } else if (level_ == JSON_MSG_OBJ_LEVEL) {
+            attrs_.helpId.assign(str, size);
+            attrs_.mask |= Attrs::HELP_ID;
             state_ = State::MSG_OBJ;
+        } else {
+            otherValue();
+        }
+    }
+
+    virtual void intValue(int val) override {
+        if (state_ == State::MSG_ID) {
+            msgIdValue(val);
+        } else {
+            otherValue();
+        }
+    }
+
+    virtual void uintValue(unsigned val) override {
+        if (state_ == State::MSG_ID) {
+            msgIdValue(val);
+        } else {
+            otherValue();
         }
     }
 
-    std::istream::pos_type lastMsgEndPos() const {
+    virtual void nullValue() override {
+        otherValue();
+    }
+
+    virtual void boolValue(bool) override {
+        otherValue();
+    }
+
+    virtual void doubleValue(double) override {
+        otherValue();
+    }
+
+    // Processes a message read from the file or the message journal
+    void processMsg(MsgId msgId, const MsgKey& key) {
+        if (deferMsgs_ && addMsgs_) {
+            // The map can't be modified in the deferred mode, so the key is added to it later
+            deferredMsgs_.push_back(DeferredMsg(nullptr, msgId));
+            deferredMsgs_.back().key = key;
+        } else {
+            // Check if there's a source message with the same attributes
+            auto it = msgMap_->find(key);
+            if (it == msgMap_->end() && addMsgs_) {
+                it = msgMap_->insert(std::make_pair(key, MsgData())).first;
+            }
+            if (it != msgMap_->end()) {
+                if (deferMsgs_) {
+                    deferredMsgs_.push_back(DeferredMsg(&*it, msgId));
+                } else {
+                    applyMsg(&*it, msgId);
+                }
+            }
+        }
+        if (binWriter_) {
+            binWriter_->add(msgId, key.fmtStr, key.hintMsg, key.helpId);
+        }
+        if (maxMsgId_ == INVALID_MSG_ID || msgId > maxMsgId_) {
+            maxMsgId_ = msgId;
+        }
+    }
+
+    // Updates the map with the messages found while parsing the file in the deferred mode
+    void applyDeferredMsgs() {
+        applyDeferredMsgs(&deferredMsgs_);
+    }
+
+    // If enabled, the messages found in the file are not applied to the map until applyDeferredMsgs() is
+    // called. The map is not modified in this mode, so the file can be parsed concurrently with other files
+    void deferMsgs(bool enabled) {
+        deferMsgs_ = enabled;
+    }
+
+    // Returns the offset of the end of the last message object in the file
+    size_t lastMsgEndPos() const {
         return lastMsgEndPos_;
     }
 
@@ -206,6 +488,16 @@ public:
         return maxMsgId_;
     }
 
+    // Sets a writer for the binary index (optional)
+    void binIndexWriter(BinIndexWriter* writer) {
+        binWriter_ = writer;
+    }
+
+    // If enabled, the messages that are not in the map are added to it
+    void addMsgs(bool enabled) {
+        addMsgs_ = enabled;
+    }
+
 private:
     enum State {
         NEW = 0x0001,
@@ -219,23 +511,196 @@ private:
         DONE = 0x0100
     };
 
+    struct DeferredMsg {
+        MsgDataMap::value_type* msg; // Message found in the map
+        MsgKey key; // Key of a message that needs to be added to the map, if `msg` is not set
+        MsgId id;
+
+        DeferredMsg(MsgDataMap::value_type* msg, MsgId id) :
+                msg(msg),
+                id(id) {
+        }
+    };
+
     struct Attrs {
-        boost::optional<std::string> fmtStr, hintMsg, helpId;
-        boost::optional<MsgId> msgId;
+        enum Mask {
+            MSG_ID = 0x01,
+            FMT_STR = 0x02,
+            HINT_MSG = 0x04,
+            HELP_ID = 0x08
+        };
+
+        std::string fmtStr, hintMsg, helpId;
+        MsgKey key;
+        MsgId msgId;
+        unsigned mask;
+
+        Attrs() :
+                msgId(INVALID_MSG_ID),
+                mask(0) {
+        }
+
+        void clear() {
+            msgId = INVALID_MSG_ID;
+            mask = 0;
+        }
     };
 
     MsgDataMap* msgMap_;
-    std::istream* strm_;
+    const char* data_;
+    size_t size_;
+    const JsonReader* reader_;
     MsgSrc msgSrc_;
 
     State state_;
     unsigned level_;
 
     Attrs attrs_;
-    std::unordered_set<MsgId> foundMsgIds_;
-    std::istream::pos_type lastMsgEndPos_;
+    std::unordered_map<MsgId, const MsgKey*> foundMsgIds_;
+    std::vector<DeferredMsg> deferredMsgs_;
+    size_t lastMsgEndPos_;
     MsgId maxMsgId_;
     unsigned msgCount_;
+    BinIndexWriter* binWriter_;
+    bool addMsgs_, deferMsgs_;
+
+    // Parses the file in chunks on multiple threads. Each chunk is parsed by a separate reader in the deferred mode,
+    // and the results are merged in the order of the chunks, so that the messages are checked for duplicate IDs and
+    // conflicts in the same order as when parsing the file sequentially. Returns false if the file needs to be
+    // parsed sequentially
+    bool parseChunks() {
+        unsigned chunkCount = std::min<size_t>(size_ / MIN_PARSE_CHUNK_SIZE, MAX_PARSER_THREAD_COUNT);
+        const unsigned cpuCount = std::thread::hardware_concurrency();
+        if (cpuCount > 0 && chunkCount > cpuCount) {
+            chunkCount = cpuCount;
+        }
+        if (chunkCount < 2) {
+            return false;
+        }
+        const auto chunks = splitMsgArray(data_, size_, chunkCount);
+        if (chunks.size() < 2) {
+            return false;
+        }
+        std::vector<std::unique_ptr<IndexReader>> readers(chunks.size());
+        std::vector<std::unique_ptr<BinIndexWriter>> binWriters(chunks.size());
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            IndexReader* const reader = new IndexReader(data_ + chunks[i].first, chunks[i].second, msgMap_, msgSrc_);
+            readers[i].reset(reader);
+            reader->deferMsgs(true);
+            reader->addMsgs(addMsgs_);
+            if (binWriter_) {
+                binWriters[i].reset(new BinIndexWriter);
+                reader->binIndexWriter(binWriters[i].get());
+            }
+        }
+        std::vector<char> failed(chunks.size(), 0);
+        const auto run = [&readers, &failed](size_t i) {
+            try {
+                readers[i]->parseElements();
+            } catch (const std::exception&) {
+                failed[i] = 1; // The error is reported by the sequential parser
+            }
+        };
+        std::vector<std::thread> threads;
+        const auto join = [&threads]() {
+            for (std::thread& t: threads) {
+                t.join();
+            }
+        };
+        try {
+            for (size_t i = 1; i < chunks.size(); ++i) {
+                threads.push_back(std::thread(run, i));
+            }
+        } catch (...) {
+            join();
+            throw;
+        }
+        run(0);
+        join();
+        if (std::count(failed.begin(), failed.end(), 1) > 0) {
+            DEBUG("Unable to parse message data in chunks");
+            return false;
+        }
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            IndexReader* const reader = readers[i].get();
+            applyDeferredMsgs(&reader->deferredMsgs_);
+            if (binWriter_) {
+                binWriter_->add(std::move(*binWriters[i]));
+            }
+            if (reader->msgCount_ > 0) {
+                lastMsgEndPos_ = chunks[i].first + reader->lastMsgEndPos_;
+                msgCount_ += reader->msgCount_;
+            }
+            if (maxMsgId_ == INVALID_MSG_ID || reader->maxMsgId_ > maxMsgId_) {
+                maxMsgId_ = reader->maxMsgId_;
+            }
+        }
+        state_ = State::DONE;
+        return true;
+    }
+
+    // Parses a chunk of the message array
+    void parseElements() {
+        JsonReader reader(data_, size_, this);
+        reader_ = &reader;
+        state_ = State::MSG_ARRAY;
+        level_ = 1;
+        reader.parseElements();
+        reader_ = nullptr;
+        checkState(State::MSG_ARRAY);
+    }
+
+    void applyDeferredMsgs(std::vector<DeferredMsg>* msgs) {
+        for (DeferredMsg& m: *msgs) {
+            MsgDataMap::value_type* msg = m.msg;
+            if (!msg) {
+                msg = &*msgMap_->insert(std::make_pair(std::move(m.key), MsgData())).first;
+            }
+            applyMsg(msg, m.id);
+        }
+        msgs->clear();
+    }
+
+    void applyMsg(MsgDataMap::value_type* msg, MsgId msgId) {
+        const MsgKey& key = msg->first;
+        MsgData& data = msg->second;
+        if (data.id == INVALID_MSG_ID) {
+            const auto r = foundMsgIds_.insert(std::make_pair(msgId, &key));
+            if (!r.second) {
+                throw Error("Duplicate message ID: %u (\"%s\", \"%s\")", msgId, r.first->second->fmtStr, key.fmtStr);
+            }
+            data.id = msgId;
+            assert(data.src == MsgSrc::NEW);
+            data.src = msgSrc_;
+            DEBUG("Found message: \"%s\", ID: %u", key.fmtStr, data.id);
+        } else if (data.id != msgId) {
+            throw Error("Conflicting message, ID: %u", msgId);
+        }
+    }
+
+    void msgIdValue(int64_t msgId) {
+        if (msgId <= 0 || msgId > INT_MAX) {
+            throw Error("Invalid message ID: %d", (int)msgId);
+        }
+        attrs_.msgId = msgId;
+        attrs_.mask |= Attrs::MSG_ID;
+        state_ = State::MSG_OBJ;
+    }
+
+    void otherValue() {
+        checkState(State::MSG_ID | State::FMT_STR | State::HINT_MSG | State::HELP_ID | State::SKIP);
+        if (state_ == State::MSG_ID) {
+            throw Error("`%s` attribute is not an integer", JSON_MSG_ID_ATTR);
+        } else if (state_ == State::FMT_STR) {
+            throw Error("`%s` attribute is not a string", JSON_FMT_STR_ATTR);
+        } else if (state_ == State::HINT_MSG) {
+            throw Error("`%s` attribute is not a string", JSON_HINT_MSG_ATTR);
+        } else if (state_ == State::HELP_ID) {
+            throw Error("`%s` attribute is not a string", JSON_HELP_ID_ATTR);
+        } else if (level_ == JSON_MSG_OBJ_LEVEL) {
+            state_ = State::MSG_OBJ;
+        }
+    }
 
     void checkState(unsigned mask) const {
         if (!(state_ & mask)) {
@@ -243,52 +708,63 @@ private:
         }
     }
 
-    static void checkInt(const Variant& val, const std::string& name) {
-        if (!val.isInt()) {
-            throw Error("`%s` attribute is not an integer", name);
+    // Moves an attribute string into an optional string of the message key, or resets the latter
+    static void setOptional(boost::optional<std::string>* opt, std::string* str, bool present) {
+        if (!present) {
+            *opt = boost::none;
+        } else if (*opt) {
+            (*opt)->swap(*str);
+        } else {
+            *opt = std::move(*str);
         }
     }
 
-    static void checkString(const Variant& val, const std::string& name) {
-        if (!val.isString()) {
-            throw Error("`%s` attribute is not a string", name);
-        }
+    static bool isEqual(const std::string& s, const char* str, size_t size) {
+        return (s.size() == size && std::memcmp(s.data(), str, size) == 0);
     }
 };
 
 class MsgIndex::IndexWriter {
 public:
-    IndexWriter(std::ostream* strm, MsgDataMap* msgMap, MsgId maxMsgId = INVALID_MSG_ID, unsigned msgSrcMask = 0) :
+    IndexWriter(std::ostream* strm, MsgDataMap* msgMap, unsigned msgSrcMask = 0) :
             writer_(strm),
             msgMap_(msgMap),
-            maxMsgId_((maxMsgId != INVALID_MSG_ID) ? maxMsgId : 0),
             msgSrcMask_(msgSrcMask),
-            msgCount_(0) {
+            msgCount_(0),
+            binWriter_(nullptr) {
     }
 
     void serialize() {
-        writer_.beginArray();
+        std::vector<const MsgDataMap::value_type*> msgs;
         for (auto it = msgMap_->begin(); it != msgMap_->end(); ++it) {
-            const MsgKey& key = it->first;
-            MsgData& data = it->second;
-            if (!msgSrcMask_ || (data.src & msgSrcMask_)) {
-                if (data.id == INVALID_MSG_ID) {
-                    data.id = ++maxMsgId_;
-                    DEBUG("New message: \"%s\", ID: %u", key.fmtStr, data.id);
-                }
-                writer_.beginObject();
-                writer_.name(JSON_MSG_ID_ATTR).value(data.id);
-                writer_.name(JSON_FMT_STR_ATTR).value(key.fmtStr);
-                if (key.hintMsg) {
-                    writer_.name(JSON_HINT_MSG_ATTR).value(*key.hintMsg);
-                }
-                if (key.helpId) {
-                    writer_.name(JSON_HELP_ID_ATTR).value(*key.helpId);
-                }
-                writer_.endObject();
-                ++msgCount_;
+            if (!msgSrcMask_ || (it->second.src & msgSrcMask_)) {
+                assert(it->second.id != INVALID_MSG_ID);
+                msgs.push_back(&*it);
             }
         }
+        // Messages are written in the order of their IDs
+        std::sort(msgs.begin(), msgs.end(), [](const MsgDataMap::value_type* m1, const MsgDataMap::value_type* m2) {
+            return (m1->second.id < m2->second.id);
+        });
+        writer_.beginArray();
+        for (const MsgDataMap::value_type* msg: msgs) {
+            const MsgKey& key = msg->first;
+            const MsgData& data = msg->second;
+            writer_.beginObject();
+            writer_.name(JSON_MSG_ID_ATTR).value(data.id);
+            writer_.name(JSON_FMT_STR_ATTR).value(key.fmtStr);
+            if (key.hintMsg) {
+                writer_.name(JSON_HINT_MSG_ATTR).value(*key.hintMsg);
+            }
+            if (key.helpId) {
+                writer_.name(JSON_HELP_ID_ATTR).value(*key.helpId);
+            }
+            writer_.endObject();
+            if (binWriter_) {
+                binWriter_->add(data.id, key.fmtStr, key.hintMsg, key.helpId);
+            }
+            ++msgCount_;
+        }
         writer_.endArray();
     }
 
@@ -296,93 +772,904 @@ public:
         return msgCount_;
     }
 
-    MsgId maxMsgId() const {
-        return maxMsgId_;
+    // Sets a writer for the binary index (optional)
+    void binIndexWriter(BinIndexWriter* writer) {
+        binWriter_ = writer;
     }
 
 private:
     JsonWriter writer_;
     MsgDataMap* msgMap_;
-    MsgId maxMsgId_;
     unsigned msgSrcMask_, msgCount_;
+    BinIndexWriter* binWriter_;
 };
 
-MsgIndex::MsgIndex(const std::string& destFile, const std::vector<std::string>& srcFiles) {
+// Loader of the source message files. The files are parsed by a pool of worker threads, concurrently with
+// the destination file, and the messages found in them are merged into the map afterwards
+class MsgIndex::SrcLoader {
+public:
+    SrcLoader(const std::vector<fs::path>& files, MsgDataMap* msgMap) :
+            files_(files),
+            readers_(files.size()),
+            errors_(files.size()),
+            next_(0) {
+        unsigned threadCount = std::min<unsigned>(files_.size(), MAX_LOADER_THREAD_COUNT);
+        const unsigned cpuCount = std::thread::hardware_concurrency();
+        if (cpuCount > 0 && threadCount > cpuCount) {
+            threadCount = cpuCount;
+        }
+        for (size_t i = 0; i < files_.size(); ++i) {
+            readers_[i].reset(new IndexReader(nullptr, 0, msgMap, MsgSrc::SRC));
+            readers_[i]->deferMsgs(true);
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            threads_.push_back(std::thread(&SrcLoader::run, this));
+        }
+    }
+
+    ~SrcLoader() {
+        join();
+    }
+
+    // Waits for the files to be parsed and merges the messages into the map in the order of the files.
+    // Returns the maximum message ID
+    MsgId merge(MsgId maxMsgId) {
+        join();
+        for (size_t i = 0; i < files_.size(); ++i) {
+            if (errors_[i]) {
+                std::rethrow_exception(errors_[i]);
+            }
+            IndexReader* const reader = readers_[i].get();
+            reader->applyDeferredMsgs();
+            const MsgId srcMaxMsgId = reader->maxMsgId();
+            if ((srcMaxMsgId != INVALID_MSG_ID) && (maxMsgId == INVALID_MSG_ID || srcMaxMsgId > maxMsgId)) {
+                maxMsgId = srcMaxMsgId;
+            }
+        }
+        return maxMsgId;
+    }
+
+private:
+    const std::vector<fs::path>& files_;
+    std::vector<std::unique_ptr<IndexReader>> readers_;
+    std::vector<std::exception_ptr> errors_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_;
+
+    void run() {
+        size_t i = 0;
+        while ((i = next_++) < files_.size()) {
+            try {
+                const FileDesc srcFd(files_[i], O_RDONLY);
+                const MappedFile srcData(srcFd);
+                IndexReader* const reader = readers_[i].get();
+                reader->data(srcData.data(), srcData.size());
+                reader->parse();
+            } catch (...) {
+                errors_[i] = std::current_exception();
+            }
+        }
+    }
+
+    void join() {
+        for (std::thread& t: threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+};
+
+// Storage backend of the message index. A backend only stores the messages, while the message IDs are assigned
+// by the index
+class MsgIndex::Store {
+public:
+    virtual ~Store() = default;
+
+    // Looks up a batch of messages. Returns true if all messages are found
+    virtual bool lookup(MsgDataMap* msgMap) = 0;
+
+    // Acquire and release exclusive access to the store
+    virtual void lock() = 0;
+    virtual void unlock() = 0;
+
+    // Looks up the messages again and gets the maximum message ID in the store, so that the IDs following it
+    // can be reserved for the new messages. Returns true if all messages are found. This method is called with
+    // exclusive access acquired
+    virtual bool reserve(MsgDataMap* msgMap, MsgId* maxMsgId) = 0;
+
+    // Stores the new messages. This method is called with exclusive access acquired, after reserve()
+    virtual void commit(MsgDataMap* msgMap) = 0;
+
+    // Stores the messages with precomputed IDs without acquiring a lock. Messages that are known to be stored
+    // already may be skipped
+    virtual void append(MsgDataMap* msgMap) = 0;
+
+    // Adds all stored messages to the map. Returns the stamp of the state the snapshot was taken from
+    virtual MsgFileStamp snapshot(MsgDataMap* msgMap) = 0;
+
+    // Returns the stamp of the current state of the store
+    virtual MsgFileStamp stamp() = 0;
+
+    // Rewrites the store in the order of message IDs
+    virtual void compact() = 0;
+
+    // Loads the store in advance, before the messages to look up are known. The loaded state is used by the next
+    // lookup if the store hasn't been modified since then. This method is called on a background thread
+    virtual void preload() = 0;
+};
+
+// Backend storing the messages in the destination JSON file, which is protected by a file lock. A binary index
+// and a journal file are maintained alongside the destination file
+class MsgIndex::JsonStore: public Store {
+public:
+    explicit JsonStore(const MsgIndex* index) :
+            index_(index),
+            destFile_(index->destFile_.string()),
+            lastMsgEndPos_(0),
+            foundMsgCount_(0),
+            totalMsgCount_(0),
+            journalSize_(0) {
+    }
+
+    virtual bool lookup(MsgDataMap* msgMap) override {
+        if (preloadedBinReader_ || preloadedMsgs_) {
+            // The loaded state is only used once
+            const std::unique_ptr<BinIndexReader> binReader = std::move(preloadedBinReader_);
+            const std::unique_ptr<MsgDataMap> msgs = std::move(preloadedMsgs_);
+            if (stamp() == preloadedStamp_) {
+                const unsigned foundMsgCount = binReader ? findMsgIds(*binReader, msgMap) : findMsgIds(*msgs, msgMap);
+                if (foundMsgCount == msgMap->size() || index_->frozen_) {
+                    return (foundMsgCount == msgMap->size());
+                }
+                resetMsgIds(msgMap);
+            }
+        }
+        if (index_->frozen_) {
+            // Other processes are not expected to modify the destination file in this mode
+            const FileDesc destFd(index_->destFile_, O_RDONLY);
+            return findMsgIds(destFd, msgMap, false);
+        }
+        DEBUG("Opening destination message file: %s", destFile_);
+        const FileDesc destFd(index_->destFile_, O_RDONLY | O_CREAT); // Ensure destination message file exists
+        // In most cases all messages are already known, so the destination file is read under a
+        // sharable lock first, which allows concurrent compiler processes to proceed in parallel
+        ipc::file_lock destLock(destFile_.data());
+        const ipc::sharable_lock<ipc::file_lock> destLockGuard(destLock);
+        return findMsgIds(destFd, msgMap);
+    }
+
+    virtual void lock() override {
+        std::unique_ptr<FileDesc> destFd(new FileDesc(index_->destFile_, O_RDWR | O_CREAT));
+        std::unique_ptr<ipc::file_lock> destLock(new ipc::file_lock(destFile_.data()));
+        destLock->lock();
+        destFd_ = std::move(destFd);
+        destLock_ = std::move(destLock);
+    }
+
+    virtual void unlock() override {
+        assert(destLock_ && destFd_);
+        binWriter_.reset();
+        destLock_->unlock();
+        destLock_.reset();
+        destFd_.reset(); // Closed after the lock is released
+    }
+
+    virtual bool reserve(MsgDataMap* msgMap, MsgId* maxMsgId) override {
+        assert(destLock_);
+        binWriter_.reset(new BinIndexWriter);
+        if (index_->journal_) {
+            return reserveJournal(msgMap, maxMsgId);
+        }
+        // Process destination file. All messages are collected in order to rebuild the binary index
+        const MappedFile destData(*destFd_);
+        IndexReader destReader(destData, msgMap, MsgSrc::DEST);
+        destReader.binIndexWriter(binWriter_.get());
+        destReader.parse();
+        replayJournal(&destReader);
+        lastMsgEndPos_ = destReader.lastMsgEndPos();
+        foundMsgCount_ = destReader.foundMsgCount();
+        totalMsgCount_ = destReader.totalMsgCount();
+        *maxMsgId = destReader.maxMsgId();
+        return (foundMsgCount_ == msgMap->size());
+    }
+
+    virtual void commit(MsgDataMap* msgMap) override {
+        assert(destLock_ && binWriter_);
+        if (index_->journal_) {
+            commitJournal(msgMap);
+            return;
+        }
+        // Save new messages to the destination file
+        DEBUG("Updating destination message file");
+        std::ostringstream newStrm;
+        newStrm.exceptions(std::ios::badbit); // Enable exceptions
+        IndexWriter newWriter(&newStrm, msgMap, MsgSrc::NEW | MsgSrc::SRC);
+        newWriter.binIndexWriter(binWriter_.get());
+        newWriter.serialize();
+        assert(newWriter.writtenMsgCount() + foundMsgCount_ == msgMap->size());
+        const std::string newJson = newStrm.str();
+        std::ostringstream destStrm;
+        destStrm.exceptions(std::ios::badbit); // Enable exceptions
+        uint64_t offs = 0;
+        if (totalMsgCount_ == 0) {
+            destStrm.write(newJson.data(), newJson.size()); // Overwrite file
+        } else {
+            offs = lastMsgEndPos_; // Append to file
+            appendJsonIndex(&destStrm, newJson);
+        }
+        destStrm.write("\n", 1);
+        destFd_->write(offs, destStrm.str());
+        // Update binary index
+        writeBinIndex(binWriter_.get());
+    }
+
+    virtual void append(MsgDataMap* msgMap) override {
+        // The destination file is neither read nor locked, so that appending processes don't wait for each other
+        // or for a compaction. The messages that are already stored according to the binary index are skipped,
+        // which is a best-effort check, as the index is not locked either. Duplicate records in the journal are
+        // merged by compact()
+        BinIndexReader binReader;
+        try {
+            if (fs::exists(index_->destFile_)) {
+                binReader.open(index_->binFile_, destStamp(), true);
+            }
+        } catch (const std::exception& e) {
+            DEBUG("Unable to open binary index file: %s", e.what()); // Not a critical error
+            binReader.close();
+        }
+        JournalWriter journalWriter(index_->journalFile_);
+        for (const MsgDataMap::value_type* msg: sortedMsgs(msgMap)) {
+            const MsgKey& key = msg->first;
+            if (!binReader.isOpen() || binReader.find(key.fmtStr, key.hintMsg, key.helpId) != msg->second.id) {
+                journalWriter.add(msg->second.id, key.fmtStr, key.hintMsg, key.helpId);
+            }
+        }
+        journalWriter.write();
+    }
+
+    virtual MsgFileStamp snapshot(MsgDataMap* msgMap) override {
+        const FileDesc destFd(index_->destFile_, O_RDONLY | O_CREAT);
+        ipc::file_lock destLock(destFile_.data());
+        const ipc::sharable_lock<ipc::file_lock> destLockGuard(destLock);
+        const MsgFileStamp destStamp = this->destStamp();
+        const MappedFile destData(destFd);
+        IndexReader destReader(destData, msgMap, MsgSrc::DEST);
+        destReader.addMsgs(true);
+        destReader.parse();
+        replayJournal(&destReader);
+        return destStamp;
+    }
+
+    virtual void preload() override {
+        if (index_->frozen_) {
+            const FileDesc destFd(index_->destFile_, O_RDONLY);
+            preload(destFd);
+            return;
+        }
+        const FileDesc destFd(index_->destFile_, O_RDONLY | O_CREAT);
+        ipc::file_lock destLock(destFile_.data());
+        const ipc::sharable_lock<ipc::file_lock> destLockGuard(destLock);
+        preload(destFd);
+    }
+
+    virtual MsgFileStamp stamp() override {
+        // Note: The file is not opened here, as that would release the lock if it's held by this process
+        return fs::exists(index_->destFile_) ? destStamp() : MsgFileStamp();
+    }
+
+    virtual void compact() override {
+        DEBUG("Compacting message file: %s", destFile_);
+        FileDesc destFd(index_->destFile_, O_RDWR | O_CREAT);
+        ipc::file_lock destLock(destFile_.data());
+        const std::lock_guard<ipc::file_lock> destLockGuard(destLock);
+        // Read all messages, including the journal left by an interrupted compaction
+        const fs::path oldJournalFile = index_->journalFile_.string() + OLD_JOURNAL_FILE_SUFFIX;
+        MsgDataMap msgMap;
+        uint64_t journalSize = 0;
+        {
+            const MappedFile destData(destFd);
+            IndexReader destReader(destData, &msgMap, MsgSrc::DEST);
+            destReader.addMsgs(true);
+            destReader.parse();
+            replayJournal(&destReader, oldJournalFile);
+            journalSize = replayJournal(&destReader);
+        }
+        // Serialize messages in memory first, so that the file is not left truncated in case of an error. Note that
+        // the file can't be replaced via a rename, since other processes may be waiting for a lock on it
+        std::ostringstream newStrm;
+        newStrm.exceptions(std::ios::badbit); // Enable exceptions
+        BinIndexWriter binWriter;
+        IndexWriter newWriter(&newStrm, &msgMap);
+        newWriter.binIndexWriter(&binWriter);
+        newWriter.serialize();
+        newStrm.write("\n", 1);
+        destFd.write(0, newStrm.str());
+        // The journal is removed only after the messages have been written to the destination file. Messages that
+        // appear in both files are not considered conflicting. Processes appending to the journal in the hash mode
+        // don't acquire the lock, so the journal is renamed first, and the records appended to it after it was read
+        // are moved to a new journal. A process that appends to the renamed journal writes its records again
+        boost::system::error_code ec;
+        fs::rename(index_->journalFile_, oldJournalFile, ec);
+        if (!ec) {
+            JournalWriter journalWriter(index_->journalFile_);
+            JournalReader(oldJournalFile).read([&journalWriter](MsgId id, const std::string& fmtStr,
+                    const boost::optional<std::string>& hintMsg, const boost::optional<std::string>& helpId) {
+                journalWriter.add(id, fmtStr, hintMsg, helpId);
+            }, journalSize);
+            journalWriter.write();
+        }
+        fs::remove(oldJournalFile);
+        writeBinIndex(&binWriter);
+        DEBUG("Number of messages: %u", newWriter.writtenMsgCount());
+    }
+
+private:
+    const MsgIndex* index_;
+    std::string destFile_;
+    std::unique_ptr<FileDesc> destFd_;
+    std::unique_ptr<ipc::file_lock> destLock_;
+    std::unique_ptr<BinIndexWriter> binWriter_;
+    std::unique_ptr<BinIndexReader> preloadedBinReader_;
+    std::unique_ptr<MsgDataMap> preloadedMsgs_;
+    MsgFileStamp preloadedStamp_;
+    size_t lastMsgEndPos_;
+    unsigned foundMsgCount_, totalMsgCount_;
+    uint64_t journalSize_;
+
+    bool reserveJournal(MsgDataMap* msgMap, MsgId* maxMsgId) {
+        const MsgFileStamp destStamp = this->destStamp();
+        BinIndexReader binReader;
+        if (binReader.open(index_->binFile_, destStamp)) {
+            // The binary index is up to date, so there's no need to parse the destination file
+            foundMsgCount_ = findMsgIds(binReader, msgMap);
+            *maxMsgId = binReader.maxMsgId();
+            binWriter_->add(binReader);
+            journalSize_ = destStamp.journalSize;
+            binReader.close();
+        } else {
+            const MappedFile destData(*destFd_);
+            IndexReader destReader(destData, msgMap, MsgSrc::DEST);
+            destReader.binIndexWriter(binWriter_.get());
+            destReader.parse();
+            journalSize_ = replayJournal(&destReader);
+            foundMsgCount_ = destReader.foundMsgCount();
+            *maxMsgId = destReader.maxMsgId();
+        }
+        return (foundMsgCount_ == msgMap->size());
+    }
+
+    void commitJournal(MsgDataMap* msgMap) {
+        // Append new messages to the journal
+        JournalWriter journalWriter(index_->journalFile_);
+        for (const MsgDataMap::value_type* msg: sortedMsgs(msgMap)) {
+            const MsgKey& key = msg->first;
+            const MsgData& data = msg->second;
+            if (data.src & (MsgSrc::NEW | MsgSrc::SRC)) {
+                assert(data.id != INVALID_MSG_ID);
+                journalWriter.add(data.id, key.fmtStr, key.hintMsg, key.helpId);
+                binWriter_->add(data.id, key.fmtStr, key.hintMsg, key.helpId);
+            }
+        }
+        journalWriter.write(journalSize_);
+        // Update binary index
+        writeBinIndex(binWriter_.get());
+    }
+
+    // Looks up messages in the destination file. This method is called with a sharable lock acquired
+    bool findMsgIds(const FileDesc& destFd, MsgDataMap* msgMap, bool updateBinIndex = true) {
+        const MsgFileStamp destStamp = this->destStamp();
+        BinIndexReader binReader;
+        if (binReader.open(index_->binFile_, destStamp)) {
+            return (findMsgIds(binReader, msgMap) == msgMap->size());
+        }
+        // Binary index is missing or out of date
+        IndexReader destReader(nullptr, 0, msgMap, MsgSrc::DEST);
+        readDest(destFd, destStamp, &destReader, updateBinIndex);
+        return (destReader.foundMsgCount() == msgMap->size());
+    }
+
+    // Parses the destination file and the journal. This method is called with a sharable lock acquired
+    void readDest(const FileDesc& destFd, const MsgFileStamp& destStamp, IndexReader* destReader,
+            bool updateBinIndex) {
+        const MappedFile destData(destFd);
+        BinIndexWriter binWriter;
+        destReader->data(destData.data(), destData.size());
+        if (updateBinIndex) {
+            destReader->binIndexWriter(&binWriter);
+        }
+        destReader->parse();
+        const uint64_t journalSize = replayJournal(destReader);
+        destReader->binIndexWriter(nullptr);
+        // The destination file can't be modified while the sharable lock is held, so it's safe to rebuild the
+        // binary index here, unless the journal needs to be repaired first
+        if (updateBinIndex && journalSize == destStamp.journalSize) {
+            try {
+                binWriter.write(index_->binFile_, destStamp);
+            } catch (const std::exception& e) {
+                DEBUG("Unable to write binary index file: %s", e.what()); // Not a critical error
+            }
+        }
+    }
+
+    // Loads the binary index, or all messages of the destination file if the index is out of date. This method
+    // is called with a sharable lock acquired, unless the frozen mode is enabled
+    void preload(const FileDesc& destFd) {
+        const MsgFileStamp destStamp = this->destStamp();
+        std::unique_ptr<BinIndexReader> binReader(new BinIndexReader);
+        std::unique_ptr<MsgDataMap> msgs;
+        if (!binReader->open(index_->binFile_, destStamp)) {
+            binReader.reset();
+            msgs.reset(new MsgDataMap);
+            IndexReader destReader(nullptr, 0, msgs.get(), MsgSrc::DEST);
+            destReader.addMsgs(true);
+            readDest(destFd, destStamp, &destReader, !index_->frozen_);
+        }
+        preloadedBinReader_ = std::move(binReader);
+        preloadedMsgs_ = std::move(msgs);
+        preloadedStamp_ = destStamp;
+    }
+
+    static unsigned findMsgIds(const BinIndexReader& binReader, MsgDataMap* msgMap) {
+        unsigned foundMsgCount = 0;
+        MsgDataMap::value_type* batch[BIN_INDEX_LOOKUP_BATCH_SIZE];
+        uint64_t hashes[BIN_INDEX_LOOKUP_BATCH_SIZE];
+        auto it = msgMap->begin();
+        while (it != msgMap->end()) {
+            // The messages are looked up in batches, after prefetching their buckets
+            unsigned batchSize = 0;
+            for (; it != msgMap->end() && batchSize < BIN_INDEX_LOOKUP_BATCH_SIZE; ++it) {
+                const MsgKey& key = it->first;
+                const uint64_t hash = keyHash(key.fmtStr, key.hintMsg, key.helpId);
+                binReader.prefetch(hash);
+                hashes[batchSize] = hash;
+                batch[batchSize++] = &*it;
+            }
+            for (unsigned i = 0; i < batchSize; ++i) {
+                const MsgKey& key = batch[i]->first;
+                const MsgId msgId = binReader.find(hashes[i], key.fmtStr, key.hintMsg, key.helpId);
+                if (msgId != INVALID_MSG_ID) {
+                    MsgData& data = batch[i]->second;
+                    data.id = msgId;
+                    data.src = MsgSrc::DEST;
+                    DEBUG("Found message: \"%s\", ID: %u", key.fmtStr, data.id);
+                    ++foundMsgCount;
+                }
+            }
+        }
+        return foundMsgCount;
+    }
+
+    static unsigned findMsgIds(const MsgDataMap& msgs, MsgDataMap* msgMap) {
+        unsigned foundMsgCount = 0;
+        for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+            const auto msg = msgs.find(it->first);
+            if (msg != msgs.end()) {
+                MsgData& data = it->second;
+                data.id = msg->second.id;
+                data.src = MsgSrc::DEST;
+                DEBUG("Found message: \"%s\", ID: %u", it->first.fmtStr, data.id);
+                ++foundMsgCount;
+            }
+        }
+        return foundMsgCount;
+    }
+
+    // Reads the journal. Returns the size of the valid part of the journal file
+    uint64_t replayJournal(IndexReader* reader) const {
+        return replayJournal(reader, index_->journalFile_);
+    }
+
+    uint64_t replayJournal(IndexReader* reader, const fs::path& file) const {
+        JournalReader journalReader(file);
+        MsgKey key;
+        return journalReader.read([reader, &key](MsgId id, const std::string& fmtStr,
+                const boost::optional<std::string>& hintMsg, const boost::optional<std::string>& helpId) {
+            key.fmtStr = fmtStr;
+            key.hintMsg = hintMsg;
+            key.helpId = helpId;
+            key.updateHash();
+            reader->processMsg(id, key);
+        });
+    }
+
+    // Rewrites the binary index after the messages have been stored. The messages are already committed at this
+    // point, so an error is not critical, but the outdated index file is removed
+    void writeBinIndex(BinIndexWriter* binWriter) const {
+        try {
+            binWriter->write(index_->binFile_, destStamp());
+        } catch (const std::exception& e) {
+            DEBUG("Unable to write binary index file: %s", e.what());
+            boost::system::error_code ec;
+            fs::remove(index_->binFile_, ec);
+        }
+    }
+
+    MsgFileStamp destStamp() const {
+        return MsgFileStamp(index_->destFile_, index_->journalFile_);
+    }
+};
+
+MsgIndex::MsgIndex(const std::string& destFile, const std::vector<std::string>& srcFiles) :
+        backend_(JSON_BACKEND),
+        hashBits_(0),
+        shardCount_(0),
+        shmMsgCount_(0),
+        idOffset_(0),
+        idStep_(1),
+        journal_(false),
+        frozen_(false),
+        sharded_(false),
+        shard_(false) {
     // Store absolute paths in order to not depend on directory changes
     assert(!destFile.empty());
     destFile_ = fs::absolute(destFile);
+    sharded_ = fs::is_directory(destFile_);
+    binFile_ = destFile_.string() + BIN_INDEX_FILE_SUFFIX;
+    journalFile_ = destFile_.string() + JOURNAL_FILE_SUFFIX;
     srcFiles_.reserve(srcFiles.size());
     for (const std::string& srcFile: srcFiles) {
         srcFiles_.push_back(fs::absolute(srcFile));
     }
 }
 
+MsgIndex::~MsgIndex() {
+    waitPreload();
+}
+
+void MsgIndex::preload() {
+    // The other modes have their own means of avoiding the loading of the destination file
+    if (sharded_ || hashBits_ || !serverSocket_.empty() || !shmName_.empty() || preloadThread_.joinable()) {
+        return;
+    }
+    Store* const store = this->store();
+    preloadThread_ = std::thread([store]() {
+        try {
+            store->preload();
+        } catch (const std::exception& e) {
+            DEBUG("Unable to preload destination message file: %s", e.what()); // Not a critical error
+        }
+    });
+}
+
+void MsgIndex::backend(const std::string& name) {
+    if (name != JSON_BACKEND) {
+        throw Error("Unknown message index backend: %s", name);
+    }
+    backend_ = name;
+    store_.reset();
+}
+
+void MsgIndex::compact() {
+    waitPreload();
+    if (sharded_) {
+        initShards();
+        for (const auto& shard: shards_) {
+            shard->compact();
+        }
+        return;
+    }
+    store()->compact();
+}
+
 void MsgIndex::process(MsgDataMap* msgMap) {
     assert(msgMap);
+    waitPreload();
     if (msgMap->empty()) {
         return;
     }
-    // Ensure destination message file exists
-    const fs::path destFilePath(destFile_);
-    const std::string destFile = destFilePath.string();
-    DEBUG("Opening destination message file: %s", destFile);
-    std::fstream destStrm;
-    destStrm.exceptions(std::ios::badbit); // Enable exceptions
-    destStrm.open(destFile, std::ios::app);
-    // TODO: Acquire a sharable lock first
-    ipc::file_lock destLock(destFile.data());
-    const std::lock_guard<ipc::file_lock> destLockGuard(destLock);
-    // Reopen destination file for reading/writing
-    destStrm.close();
-    destStrm.open(destFile, std::ios::in | std::ios::out | std::ios::binary);
-    if (!destStrm.is_open()) {
-        throw Error("Unable to open message file: %s", destFile);
-    }
-    // Process destination file
-    IndexReader destReader(&destStrm, msgMap, MsgSrc::DEST);
-    destReader.parse();
-    if (destReader.foundMsgCount() == msgMap->size()) {
+    if (!frozen_ && !hashBits_ && !serverSocket_.empty() && requestMsgIds(msgMap)) {
+        return; // All messages have been processed by the server
+    }
+    if (sharded_) {
+        processShards(msgMap);
+        return;
+    }
+    if (frozen_) {
+        if (!fs::exists(destFile_)) {
+            if (shard_) {
+                return; // Shard files are created on demand
+            }
+            throw Error("Unable to open message file: %s", destFile_.string());
+        }
+        store()->lookup(msgMap);
+        return;
+    }
+    if (hashBits_) {
+        assignHashIds(msgMap);
+        return;
+    }
+    if (!shmName_.empty() && processShm(msgMap)) {
+        return;
+    }
+    processStore(msgMap);
+}
+
+void MsgIndex::processStore(MsgDataMap* msgMap) {
+    Store* const store = this->store();
+    if (store->lookup(msgMap)) {
         return; // All messages have been processed
     }
-    // Process source message files
-    MsgId maxMsgId = destReader.maxMsgId();
-    for (const fs::path& srcFilePath: srcFiles_) {
-        const std::string srcFile = srcFilePath.string();
-        DEBUG("Opening source message file: %s", srcFile);
-        std::ifstream srcStrm;
-        srcStrm.exceptions(std::ios::badbit); // Enable exceptions
-        srcStrm.open(srcFile, std::ios::in | std::ios::binary);
-        if (!srcStrm.is_open()) {
-            throw Error("Unable to open message file: %s", srcFile);
-        }
-        IndexReader srcReader(&srcStrm, msgMap, MsgSrc::SRC);
-        srcReader.parse();
-        const MsgId srcMaxMsgId = srcReader.maxMsgId();
-        if ((srcMaxMsgId != INVALID_MSG_ID) && (maxMsgId == INVALID_MSG_ID || srcMaxMsgId > maxMsgId)) {
-            maxMsgId = srcMaxMsgId;
-        }
-    }
-    // Save new messages to the destination file
-    DEBUG("Updating destination message file");
-    std::ostringstream newStrm;
-    newStrm.exceptions(std::ios::badbit); // Enable exceptions
-    IndexWriter newWriter(&newStrm, msgMap, maxMsgId, MsgSrc::NEW | MsgSrc::SRC);
-    newWriter.serialize();
-    assert(newWriter.writtenMsgCount() + destReader.foundMsgCount() == msgMap->size());
-    const std::string newJson = newStrm.str();
-    destStrm.clear(); // Clear state flags
-    if (destReader.totalMsgCount() == 0) {
-        destStrm.seekp(0); // Overwrite file
-        destStrm.write(newJson.data(), newJson.size());
+    // The lock can't be upgraded atomically, so the messages need to be looked up again after acquiring
+    // exclusive access, as the store may have been updated by another process in the meantime
+    resetMsgIds(msgMap);
+    // Source message files are parsed in the background while the store is being read
+    SrcLoader srcLoader(srcFiles_, msgMap);
+    const std::lock_guard<Store> lock(*store);
+    MsgId maxMsgId = INVALID_MSG_ID;
+    if (store->reserve(msgMap, &maxMsgId)) {
+        return;
+    }
+    maxMsgId = srcLoader.merge(maxMsgId);
+    assignMsgIds(msgMap, maxMsgId);
+    store->commit(msgMap);
+}
+
+void MsgIndex::assignMsgIds(MsgDataMap* msgMap, MsgId maxMsgId) const {
+    for (MsgDataMap::value_type* msg: sortedMsgs(msgMap)) {
+        MsgData& data = msg->second;
+        if (data.id == INVALID_MSG_ID) {
+            data.id = maxMsgId = nextMsgId(maxMsgId);
+            DEBUG("New message: \"%s\", ID: %u", msg->first.fmtStr, data.id);
+        }
+    }
+}
+
+void MsgIndex::assignHashIds(MsgDataMap* msgMap) {
+    assert(hashBits_ > 0 && hashBits_ <= 31);
+    const uint64_t maxMsgId = (1ull << hashBits_) - 1;
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        const MsgKey& key = it->first;
+        MsgData& data = it->second;
+        if (data.id == INVALID_MSG_ID) {
+            // Map the hash value to the range [1, maxMsgId]
+            data.id = keyHash(key.fmtStr, key.hintMsg, key.helpId) % maxMsgId + 1;
+            DEBUG("Message: \"%s\", ID: %u", key.fmtStr, data.id);
+        }
+    }
+    store()->append(msgMap);
+}
+
+uint64_t MsgIndex::keyHash(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    // Note: Changing this function changes the message IDs assigned in the hash mode
+    Fnv1aHash h;
+    h.add(fmtStr.data(), fmtStr.size() + 1); // Include term. null
+    h.add((char)(hintMsg ? 1 : 0)); // Distinguishes a missing string from an empty one
+    if (hintMsg) {
+        h.add(*hintMsg);
+    }
+    h.add((char)(helpId ? 1 : 0));
+    if (helpId) {
+        h.add(*helpId);
+    }
+    return h.value();
+}
+
+bool MsgIndex::requestMsgIds(MsgDataMap* msgMap) {
+    MsgClient client;
+    if (!client.connect(serverSocket_)) {
+        return false; // Server is not running
+    }
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        const MsgKey& key = it->first;
+        client.add(key.fmtStr, key.hintMsg, key.helpId);
+    }
+    std::vector<MsgId> msgIds;
+    if (!client.send(&msgIds)) {
+        DEBUG("Unable to communicate with message server");
+        return false;
+    }
+    auto id = msgIds.begin();
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        MsgData& data = it->second;
+        data.id = *id++;
+        data.src = MsgSrc::DEST;
+    }
+    return true;
+}
+
+void MsgIndex::resetMsgIds(MsgDataMap* msgMap) {
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        MsgData& data = it->second;
+        data.id = INVALID_MSG_ID;
+        data.src = MsgSrc::NEW;
+    }
+}
+
+bool MsgIndex::processShm(MsgDataMap* msgMap) {
+    ShmIndex shm(shmName_, shmMsgCount_);
+    if (!shm.open()) {
+        return false;
+    }
+    Store* const store = this->store();
+    const auto findMsgIds = [&shm, msgMap]() {
+        unsigned foundMsgCount = 0;
+        for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+            const MsgKey& key = it->first;
+            const MsgId msgId = shm.find(key.fmtStr, key.hintMsg, key.helpId);
+            if (msgId != INVALID_MSG_ID) {
+                MsgData& data = it->second;
+                data.id = msgId;
+                data.src = MsgSrc::DEST;
+                ++foundMsgCount;
+            }
+        }
+        return (foundMsgCount == msgMap->size());
+    };
+    // Fast path: all messages are known
+    if (!shm.lockSharable()) {
+        DEBUG("Unable to lock shared memory segment: %s", shmName_);
+        return false;
+    }
+    bool done = false, full = false;
+    try {
+        full = shm.isFull();
+        done = (!full && shm.isUpToDate(store->stamp()) && findMsgIds());
+    } catch (...) {
+        shm.unlockSharable();
+        throw;
+    }
+    shm.unlockSharable();
+    if (full) {
+        DEBUG("Shared memory segment is too small for the destination message file: %s", shmName_);
+        return false;
+    }
+    if (done) {
+        DEBUG("Found all messages in shared memory segment: %s", shmName_);
+        return true;
+    }
+    resetMsgIds(msgMap);
+    if (!shm.lock()) {
+        DEBUG("Unable to lock shared memory segment: %s", shmName_);
+        return false;
+    }
+    const auto addMsgs = [&shm](const MsgDataMap& msgMap, const MsgFileStamp& stamp) {
+        bool ok = true;
+        for (auto it = msgMap.begin(); it != msgMap.end() && ok; ++it) {
+            ok = shm.add(it->second.id, it->first.fmtStr, it->first.hintMsg, it->first.helpId);
+        }
+        if (ok) {
+            shm.stamp(stamp);
+        } else {
+            // The segment is not used anymore, rather than being reloaded by every process
+            shm.markFull();
+        }
+        return ok;
+    };
+    try {
+        // Reload the store if it has been modified by a process not using the segment
+        full = shm.isFull();
+        if (!full && !shm.isUpToDate(store->stamp())) {
+            DEBUG("Loading destination message file into shared memory segment: %s", shmName_);
+            shm.clear();
+            MsgDataMap destMap;
+            const MsgFileStamp destStamp = store->snapshot(&destMap);
+            full = !addMsgs(destMap, destStamp);
+        }
+        if (!full && !findMsgIds()) {
+            // Update the store and add new messages to the segment
+            resetMsgIds(msgMap);
+            processStore(msgMap);
+            // Messages added by processes not using the segment are added to it on a lookup miss
+            const std::lock_guard<Store> lock(*store);
+            addMsgs(*msgMap, store->stamp());
+        }
+    } catch (...) {
+        shm.unlock();
+        throw;
+    }
+    shm.unlock();
+    if (full) {
+        DEBUG("Shared memory segment is too small for the destination message file: %s", shmName_);
+        resetMsgIds(msgMap);
+        return false;
+    }
+    return true;
+}
+
+void MsgIndex::processShards(MsgDataMap* msgMap) {
+    initShards();
+    std::vector<MsgDataMap> shardMaps(shards_.size());
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        const MsgKey& key = it->first;
+        const unsigned i = keyHash(key.fmtStr, key.hintMsg, key.helpId) % shards_.size();
+        shardMaps[i].insert(std::move(*it));
+    }
+    msgMap->clear();
+    // Only the shards containing the messages are locked, one at a time
+    for (unsigned i = 0; i < shards_.size(); ++i) {
+        MsgDataMap& shardMap = shardMaps[i];
+        if (!shardMap.empty()) {
+            shards_[i]->process(&shardMap);
+            msgMap->insert(std::make_move_iterator(shardMap.begin()), std::make_move_iterator(shardMap.end()));
+        }
+    }
+}
+
+void MsgIndex::initShards() {
+    if (!shards_.empty()) {
+        return;
+    }
+    // Get the number of shards
+    unsigned shardCount = shardCount_;
+    const fs::path countFile = destFile_ / SHARD_COUNT_FILE_NAME;
+    std::ifstream countStrm(countFile.string());
+    if (countStrm.is_open()) {
+        unsigned n = 0;
+        if (!(countStrm >> n) || n == 0) {
+            throw Error("Invalid format of the shard count file: %s", countFile.string());
+        }
+        if (shardCount && shardCount != n) {
+            throw Error("Number of shards doesn't match the existing message directory: %s", destFile_.string());
+        }
+        shardCount = n;
     } else {
-        destStrm.seekp(destReader.lastMsgEndPos()); // Append to file
-        appendJsonIndex(&destStrm, newJson);
+        if (frozen_) {
+            throw Error("Unable to open message file: %s", countFile.string());
+        }
+        if (!shardCount) {
+            shardCount = DEFAULT_SHARD_COUNT;
+        }
+        // Concurrent processes can only write the same contents, but the file is replaced atomically anyway
+        const fs::path tmpFile = fs::unique_path(countFile.string() + ".%%%%-%%%%");
+        std::ofstream tmpStrm;
+        tmpStrm.exceptions(std::ios::badbit | std::ios::failbit); // Enable exceptions
+        tmpStrm.open(tmpFile.string(), std::ios::out | std::ios::trunc);
+        tmpStrm << shardCount << std::endl;
+        tmpStrm.close();
+        fs::rename(tmpFile, countFile);
+    }
+    std::vector<std::string> srcFiles;
+    for (const fs::path& srcFile: srcFiles_) {
+        srcFiles.push_back(srcFile.string());
     }
-    if (fs::file_size(destFilePath) > (size_t)destStrm.tellp()) {
-        fs::resize_file(destFilePath, destStrm.tellp());
+    for (unsigned i = 0; i < shardCount; ++i) {
+        std::unique_ptr<MsgIndex> shard(new MsgIndex((destFile_ / shardFileName(i)).string(), srcFiles));
+        shard->backend_ = backend_;
+        shard->hashBits_ = hashBits_;
+        shard->journal_ = journal_;
+        shard->frozen_ = frozen_;
+        shard->shard_ = true;
+        // The ID sequences of the shards don't overlap
+        shard->idOffset_ = i;
+        shard->idStep_ = shardCount;
+        shards_.push_back(std::move(shard));
+    }
+}
+
+MsgId MsgIndex::nextMsgId(MsgId maxMsgId) const {
+    const MsgId id = maxMsgId + 1;
+    const MsgId n = id + (idOffset_ + idStep_ - (id - 1) % idStep_) % idStep_;
+    if (n > (MsgId)INT_MAX) { // Message IDs are stored as signed integers in the message files
+        throw Error("Message ID is out of range: %u", n);
+    }
+    return n;
+}
+
+MsgIndex::Store* MsgIndex::store() {
+    if (!store_) {
+        assert(backend_ == JSON_BACKEND);
+        store_.reset(new JsonStore(this));
+    }
+    return store_.get();
+}
+
+void MsgIndex::waitPreload() {
+    if (preloadThread_.joinable()) {
+        preloadThread_.join();
+    }
+}
+
+std::vector<MsgIndex::MsgDataMap::value_type*> MsgIndex::sortedMsgs(MsgDataMap* msgMap) {
+    std::vector<MsgDataMap::value_type*> msgs;
+    msgs.reserve(msgMap->size());
+    for (auto it = msgMap->begin(); it != msgMap->end(); ++it) {
+        msgs.push_back(&*it);
     }
-    destStrm.write("\n", 1);
-    destStrm.close(); // Flush stream before releasing the file lock
+    std::sort(msgs.begin(), msgs.end(), [](const MsgDataMap::value_type* m1, const MsgDataMap::value_type* m2) {
+        return MsgKey::Less()(m1->first, m2->first);
+    });
+    return msgs;
 }
 
 } // namespace particle
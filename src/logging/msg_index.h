@@ -17,13 +17,18 @@
 
 #pragma once
 
+#include "util/hash.h"
+#include "error.h"
 #include "common.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
-#include <boost/functional/hash.hpp>
 
 #include <unordered_map>
+#include <vector>
+#include <thread>
+#include <iterator>
+#include <tuple>
 
 namespace particle {
 
@@ -40,11 +45,59 @@ public:
 
     explicit MsgIndex(const std::string& destFile);
     MsgIndex(const std::string& destFile, const std::vector<std::string>& srcFiles);
+    ~MsgIndex();
 
     // Assigns IDs to the source messages
     template<typename IterT>
     void process(IterT begin, IterT end);
 
+    // Starts loading the destination file on a background thread, so that it's ready for a lookup by the time
+    // the messages are known. process() waits for the loading to complete. The loading is not started in the
+    // hash and sharded modes, or if a message server or a shared memory segment is used
+    void preload();
+
+    // Selects the storage backend by name. The only backend currently available is "json" (default), which
+    // stores the messages in the destination JSON file protected by a file lock
+    void backend(const std::string& name);
+
+    // Enables the journal mode. In this mode, new messages are appended to a separate journal file instead of
+    // the destination message file. Use compact() to merge the journal into the destination file
+    void journalMode(bool enabled);
+
+    // Merges the journal into the destination file. The messages are written in the order of their IDs
+    void compact();
+
+    // Enables the hash mode. In this mode, message IDs are derived from a hash of the message attributes,
+    // truncated to `bits` bits, and explicit message IDs take precedence. The destination file is neither read
+    // nor updated in this mode, and messages that are not found in the binary index are appended to the journal,
+    // which needs to be compacted after the build in order to detect conflicting IDs
+    void hashMode(unsigned bits);
+
+    // Enables the frozen mode. In this mode, the destination file is read without acquiring a lock and is never
+    // modified. Messages that are not found in the file are left without an ID (INVALID_MSG_ID)
+    void frozenMode(bool enabled);
+
+    // Sets the number of shard files used when the destination path is a directory (16 by default). Each message
+    // is stored in one of the shard files, depending on a hash of its attributes, and each shard file has its own
+    // lock and its own interleaved sequence of message IDs. The number of shards is stored in the directory when
+    // it's used for the first time, and can't be changed afterwards
+    void shardCount(unsigned count);
+
+    // Sets name of a shared memory segment caching the contents of the destination file (optional). The
+    // segment is shared by all processes using the same name, so that the file is loaded only once, and is
+    // updated whenever new messages are added to the file. The segment is not used with a sharded directory.
+    // `maxMsgCount` is the capacity of the segment (0 for the default capacity). If the file doesn't fit in the
+    // segment, the segment is not used until it's removed or a larger capacity is specified
+    void sharedMemory(const std::string& name, unsigned maxMsgCount = 0);
+
+    // Sets path to the socket of a message server (optional). If the server is not running, message IDs
+    // are assigned by this process
+    void serverSocket(const std::string& file);
+
+    // Returns a stable hash of the message attributes
+    static uint64_t keyHash(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId);
+
 private:
     // Message source
     enum MsgSrc {
@@ -56,20 +109,44 @@ private:
     struct MsgKey {
         boost::optional<std::string> hintMsg, helpId;
         std::string fmtStr;
+        uint64_t hash; // Cached hash of the attributes. Needs to be updated whenever the attributes are modified
+
+        MsgKey() :
+                hash(0) {
+        }
+
+        void updateHash() {
+            hash = computeHash();
+        }
+
+        // Unlike keyHash(), this function is only used for the in-memory data structures, so its values don't
+        // need to be stable
+        uint64_t computeHash() const {
+            const auto add = [](uint64_t h, const boost::optional<std::string>& s) {
+                return s ? murmurHash64(s->data(), s->size(), h) : murmurHash64(nullptr, 0, ~h);
+            };
+            return add(add(murmurHash64(fmtStr.data(), fmtStr.size()), hintMsg), helpId);
+        }
 
         struct Hash {
             size_t operator()(const MsgKey& key) const {
-                size_t h = 0;
-                boost::hash_combine(h, key.fmtStr);
-                boost::hash_combine(h, (key.hintMsg ? *key.hintMsg : std::string()));
-                boost::hash_combine(h, (key.helpId ? *key.helpId : std::string()));
-                return h;
+                assert(key.hash == key.computeHash());
+                return key.hash;
             }
         };
 
         struct Equal {
             bool operator()(const MsgKey& key1, const MsgKey& key2) const {
-                return (key1.fmtStr == key2.fmtStr && key1.hintMsg == key2.hintMsg && key1.helpId == key2.helpId);
+                // The strings are compared only if the hashes match
+                return (key1.hash == key2.hash && key1.fmtStr == key2.fmtStr && key1.hintMsg == key2.hintMsg &&
+                        key1.helpId == key2.helpId);
+            }
+        };
+
+        struct Less {
+            bool operator()(const MsgKey& key1, const MsgKey& key2) const {
+                return (std::tie(key1.fmtStr, key1.hintMsg, key1.helpId) <
+                        std::tie(key2.fmtStr, key2.hintMsg, key2.helpId));
             }
         };
     };
@@ -77,7 +154,7 @@ private:
     struct MsgData {
         MsgId id;
         MsgSrc src;
-        std::list<Msg*> msgList; // Source messages
+        std::vector<Msg*> msgList; // Source messages
 
         MsgData() :
                 id(INVALID_MSG_ID),
@@ -89,20 +166,66 @@ private:
 
     class IndexReader;
     class IndexWriter;
+    class SrcLoader;
+    class Store;
+    class JsonStore;
 
-    fs::path destFile_;
+    fs::path destFile_, binFile_, journalFile_;
     std::vector<fs::path> srcFiles_;
+    std::string backend_, serverSocket_, shmName_;
+    std::unique_ptr<Store> store_;
+    std::vector<std::unique_ptr<MsgIndex>> shards_;
+    std::thread preloadThread_;
+    unsigned hashBits_, shardCount_, shmMsgCount_;
+    unsigned idOffset_, idStep_; // New IDs are assigned so that `(id - 1) % idStep_ == idOffset_`
+    bool journal_, frozen_, sharded_, shard_;
 
     void process(MsgDataMap* msgMap);
+
+    // Looks up messages in the store and stores the new ones
+    void processStore(MsgDataMap* msgMap);
+
+    // Looks up messages in the shared memory segment and updates the store if necessary. Returns false if the
+    // segment is not available
+    bool processShm(MsgDataMap* msgMap);
+
+    // Assigns IDs following `maxMsgId` to new messages
+    void assignMsgIds(MsgDataMap* msgMap, MsgId maxMsgId) const;
+
+    // Assigns hash-based IDs to new messages
+    void assignHashIds(MsgDataMap* msgMap);
+
+    // Requests message IDs from the message server
+    bool requestMsgIds(MsgDataMap* msgMap);
+
+    // Distributes the messages between the shard files
+    void processShards(MsgDataMap* msgMap);
+    void initShards();
+
+    // Returns the storage backend, creating it if necessary
+    Store* store();
+
+    // Waits for the background loading of the destination file to complete
+    void waitPreload();
+
+    // Returns the next message ID after `maxMsgId` in the ID sequence of this index
+    MsgId nextMsgId(MsgId maxMsgId) const;
+
+    // Resets the message IDs found in the message files
+    static void resetMsgIds(MsgDataMap* msgMap);
+
+    // Returns the messages ordered by their keys. New message IDs are assigned in this order, so that they
+    // don't depend on the iteration order of the hash map
+    static std::vector<MsgDataMap::value_type*> sortedMsgs(MsgDataMap* msgMap);
 };
 
 class MsgIndex::Msg {
 public:
     virtual void msgId(MsgId id) = 0; // Sets message ID
     virtual MsgId msgId() const = 0; // Returns message ID
-    virtual std::string fmtStr() const = 0; // Returns format string
-    virtual std::string hintMsg() const = 0;  // Returns hint message
-    virtual std::string helpId() const = 0; // Returns help entry ID
+    virtual const std::string& fmtStr() const = 0; // Returns format string
+    virtual const std::string& hintMsg() const = 0;  // Returns hint message
+    virtual const std::string& helpId() const = 0; // Returns help entry ID
     virtual std::string srcFile() const = 0; // Returns source file name
     virtual unsigned srcLine() const = 0; // Returns source line number
 };
@@ -111,26 +234,63 @@ inline MsgIndex::MsgIndex(const std::string& destFile) :
         MsgIndex(destFile, std::vector<std::string>()) {
 }
 
+inline void MsgIndex::journalMode(bool enabled) {
+    journal_ = enabled;
+}
+
+inline void MsgIndex::frozenMode(bool enabled) {
+    frozen_ = enabled;
+}
+
+inline void MsgIndex::hashMode(unsigned bits) {
+    hashBits_ = bits;
+}
+
+inline void MsgIndex::shardCount(unsigned count) {
+    assert(count > 0);
+    shardCount_ = count;
+}
+
+inline void MsgIndex::sharedMemory(const std::string& name, unsigned maxMsgCount) {
+    shmName_ = name;
+    shmMsgCount_ = maxMsgCount;
+}
+
+inline void MsgIndex::serverSocket(const std::string& file) {
+    serverSocket_ = file;
+}
+
 template<typename IterT>
 inline void MsgIndex::process(IterT begin, IterT end) {
     MsgDataMap msgMap;
+    msgMap.reserve(std::distance(begin, end));
     for (auto msg = begin; msg != end; ++msg) {
         MsgKey key;
         key.fmtStr = msg->fmtStr();
-        std::string s = msg->hintMsg();
-        if (!s.empty()) {
-            key.hintMsg = std::move(s);
+        const std::string& hintMsg = msg->hintMsg();
+        if (!hintMsg.empty()) {
+            key.hintMsg = hintMsg;
         }
-        s = msg->helpId();
-        if (!s.empty()) {
-            key.helpId = std::move(s);
+        const std::string& helpId = msg->helpId();
+        if (!helpId.empty()) {
+            key.helpId = helpId;
         }
+        key.updateHash();
         const auto it = msgMap.insert(std::make_pair(std::move(key), MsgData())).first;
-        it->second.msgList.push_back(&*msg);
+        MsgData& data = it->second;
+        if (hashBits_ && msg->msgId() != INVALID_MSG_ID) {
+            // Explicit message IDs take precedence in the hash mode
+            if (data.id == INVALID_MSG_ID) {
+                data.id = msg->msgId();
+            } else if (data.id != msg->msgId()) {
+                throw Error("Conflicting message, ID: %u", msg->msgId());
+            }
+        }
+        data.msgList.push_back(&*msg);
     }
     process(&msgMap);
     for (auto it = msgMap.begin(); it != msgMap.end(); ++it) {
-        assert(it->second.id != INVALID_MSG_ID);
+        assert(it->second.id != INVALID_MSG_ID || frozen_);
         for (Msg* msg: it->second.msgList) {
             msg->msgId(it->second.id);
         }
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/msg_journal.h"
+
+#include "error.h"
+#include "debug.h"
+
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace particle {
+
+namespace {
+
+// Record format (all integers are stored in host byte order):
+//
+// uint32_t magic
+// uint32_t size // Size of the payload
+// uint32_t checksum // Checksum of the payload
+// uint32_t id // Payload
+// uint32_t flags
+// uint32_t fmtStrSize
+// char fmtStr[fmtStrSize]
+// uint32_t hintMsgSize // If (flags & HAS_HINT_MSG)
+// char hintMsg[hintMsgSize]
+// uint32_t helpIdSize // If (flags & HAS_HELP_ID)
+// char helpId[helpIdSize]
+const uint32_t RECORD_MAGIC = 0x524a4d50; // "PMJR"
+const size_t RECORD_HEADER_SIZE = 3 * sizeof(uint32_t);
+
+// Maximum number of attempts to write the records again if the journal is renamed concurrently
+const unsigned MAX_WRITE_ATTEMPTS = 10;
+
+enum RecordFlag {
+    HAS_HINT_MSG = 0x01,
+    HAS_HELP_ID = 0x02
+};
+
+// FNV-1a
+uint32_t checksum(const char* data, size_t size) {
+    uint32_t h = 0x811c9dc5;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ (uint8_t)data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+void appendUint(std::string* data, uint32_t val) {
+    data->append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void appendStr(std::string* data, const std::string& str) {
+    appendUint(data, str.size());
+    data->append(str);
+}
+
+class RecordParser {
+public:
+    RecordParser(const char* data, size_t size) :
+            p_(data),
+            end_(data + size) {
+    }
+
+    bool readUint(uint32_t* val) {
+        if (end_ - p_ < (ptrdiff_t)sizeof(uint32_t)) {
+            return false;
+        }
+        std::memcpy(val, p_, sizeof(uint32_t));
+        p_ += sizeof(uint32_t);
+        return true;
+    }
+
+    bool readStr(std::string* str) {
+        uint32_t size = 0;
+        if (!readUint(&size) || end_ - p_ < (ptrdiff_t)size) {
+            return false;
+        }
+        str->assign(p_, size);
+        p_ += size;
+        return true;
+    }
+
+    bool atEnd() const {
+        return (p_ == end_);
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+} // namespace
+
+uint64_t JournalReader::read(const Handler& handler, uint64_t offs) {
+    const std::string file = file_.string();
+    std::ifstream strm;
+    strm.exceptions(std::ios::badbit); // Enable exceptions
+    strm.open(file, std::ios::in | std::ios::binary);
+    if (!strm.is_open()) {
+        return 0; // Journal doesn't exist
+    }
+    DEBUG("Reading message journal: %s", file);
+    const std::string data((std::istreambuf_iterator<char>(strm)), std::istreambuf_iterator<char>());
+    if (offs > data.size()) {
+        offs = data.size();
+    }
+    uint64_t validSize = offs;
+    while (data.size() - offs >= RECORD_HEADER_SIZE) {
+        uint32_t h[3] = { 0 }; // magic, size, checksum
+        std::memcpy(h, data.data() + offs, RECORD_HEADER_SIZE);
+        const char* const payload = data.data() + offs + RECORD_HEADER_SIZE;
+        if (h[0] != RECORD_MAGIC || h[1] > data.size() - offs - RECORD_HEADER_SIZE ||
+                checksum(payload, h[1]) != h[2]) {
+            // The record is either incomplete or corrupted, e.g. due to an interrupted write. Find the
+            // beginning of the next record
+            ++offs;
+            continue;
+        }
+        RecordParser p(payload, h[1]);
+        uint32_t id = INVALID_MSG_ID, flags = 0;
+        std::string fmtStr, s;
+        boost::optional<std::string> hintMsg, helpId;
+        if (!p.readUint(&id) || !p.readUint(&flags) || !p.readStr(&fmtStr)) {
+            throw Error("Invalid format of the message journal: %s", file);
+        }
+        if (flags & HAS_HINT_MSG) {
+            if (!p.readStr(&s)) {
+                throw Error("Invalid format of the message journal: %s", file);
+            }
+            hintMsg = std::move(s);
+        }
+        if (flags & HAS_HELP_ID) {
+            if (!p.readStr(&s)) {
+                throw Error("Invalid format of the message journal: %s", file);
+            }
+            helpId = std::move(s);
+        }
+        if (!p.atEnd() || id == INVALID_MSG_ID) {
+            throw Error("Invalid format of the message journal: %s", file);
+        }
+        handler(id, fmtStr, hintMsg, helpId);
+        offs += RECORD_HEADER_SIZE + h[1];
+        validSize = offs;
+    }
+    return validSize;
+}
+
+void JournalWriter::add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    std::string payload;
+    appendUint(&payload, id);
+    appendUint(&payload, (hintMsg ? HAS_HINT_MSG : 0) | (helpId ? HAS_HELP_ID : 0));
+    appendStr(&payload, fmtStr);
+    if (hintMsg) {
+        appendStr(&payload, *hintMsg);
+    }
+    if (helpId) {
+        appendStr(&payload, *helpId);
+    }
+    appendUint(&data_, RECORD_MAGIC);
+    appendUint(&data_, payload.size());
+    appendUint(&data_, checksum(payload.data(), payload.size()));
+    data_.append(payload);
+}
+
+void JournalWriter::write(uint64_t validSize) {
+    write(validSize, true);
+}
+
+void JournalWriter::write() {
+    write(0, false);
+}
+
+void JournalWriter::write(uint64_t validSize, bool truncate) {
+    if (data_.empty()) {
+        return;
+    }
+    const std::string file = file_.string();
+    DEBUG("Updating message journal: %s", file);
+    for (unsigned attempt = 0;; ++attempt) {
+        const int fd = ::open(file.data(), O_WRONLY | O_APPEND | O_CREAT, 0666);
+        if (fd < 0) {
+            throw Error("Unable to open message journal: %s: %s", file, std::strerror(errno));
+        }
+        struct stat st = {};
+        if (truncate && ::fstat(fd, &st) == 0 && (uint64_t)st.st_size > validSize &&
+                JournalReader(file_).read([](MsgId, const std::string&, const boost::optional<std::string>&,
+                        const boost::optional<std::string>&) {}, validSize) == validSize) {
+            DEBUG("Discarding incomplete records at the end of the journal");
+            if (::ftruncate(fd, validSize) != 0) {
+                const int err = errno;
+                ::close(fd);
+                throw Error("Unable to truncate message journal: %s: %s", file, std::strerror(err));
+            }
+        }
+        const ssize_t n = ::write(fd, data_.data(), data_.size());
+        const int err = errno;
+        // Check if the journal has been renamed before the records were written to it
+        struct stat fdSt = {}, fileSt = {};
+        const bool renamed = (::fstat(fd, &fdSt) != 0 || ::stat(file.data(), &fileSt) != 0 ||
+                fdSt.st_dev != fileSt.st_dev || fdSt.st_ino != fileSt.st_ino);
+        ::close(fd);
+        if (n != (ssize_t)data_.size()) {
+            throw Error("Unable to write message journal: %s: %s", file, (n < 0) ? std::strerror(err) : "Short write");
+        }
+        if (!renamed) {
+            break;
+        }
+        if (attempt == MAX_WRITE_ATTEMPTS) {
+            throw Error("Unable to write message journal: %s: File is being replaced", file);
+        }
+        DEBUG("Message journal has been renamed, writing the records again");
+    }
+    data_.clear();
+}
+
+} // namespace particle
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/msg_index.h"
+#include "common.h"
+
+namespace particle {
+
+// Reader for the message journal. The journal is an append-only file of framed message records that is
+// maintained alongside the destination message file
+class JournalReader {
+public:
+    typedef std::function<void(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId)> Handler;
+
+    explicit JournalReader(const fs::path& file);
+
+    // Replays the records of the journal starting at offset `offs`. Corrupted records are skipped. Returns the end
+    // offset of the last valid record, which may be smaller than the file size if the last write to the journal
+    // has been interrupted
+    uint64_t read(const Handler& handler, uint64_t offs = 0);
+
+private:
+    fs::path file_;
+};
+
+// Writer for the message journal
+class JournalWriter {
+public:
+    explicit JournalWriter(const fs::path& file);
+
+    void add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId);
+
+    // Appends all added records to the journal file using a single write operation. The journal file is
+    // truncated to `validSize` bytes first, in case it has an incomplete record at the end, unless valid records
+    // have been appended after that offset by a process not holding the lock
+    void write(uint64_t validSize);
+
+    // Appends all added records to the journal file without truncating it. Appending to a file opened with
+    // O_APPEND is atomic on local file systems, so this method can be called without holding a lock. If the
+    // journal is renamed while it's being written, e.g. by a compaction, the records are written again to
+    // the new journal file
+    void write();
+
+private:
+    std::string data_;
+    fs::path file_;
+
+    void write(uint64_t validSize, bool truncate);
+};
+
+inline JournalReader::JournalReader(const fs::path& file) :
+        file_(file) {
+}
+
+inline JournalWriter::JournalWriter(const fs::path& file) :
+        file_(file) {
+}
+
+} // namespace particle
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/msg_manifest.h"
+
+#include "util/string.h"
+#include "error.h"
+
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace particle {
+
+namespace {
+
+// Each record of the manifest consists of the following null-terminated strings:
+//
+// version
+// symbol
+// fmtStr
+// hintMsg // Prefixed with '+' if the attribute is set, or '-' otherwise
+// helpId // ditto
+// srcFile
+// srcLine
+const std::string MANIFEST_VERSION = "1";
+const unsigned MANIFEST_FIELD_COUNT = 7;
+
+const std::string MSG_ID_SYMBOL_PREFIX = "__particle_msg_id_";
+
+void appendField(std::string* data, const std::string& str) {
+    data->append(str.data(), str.size() + 1); // Include term. null
+}
+
+void appendField(std::string* data, const boost::optional<std::string>& str) {
+    appendField(data, str ? '+' + *str : std::string("-"));
+}
+
+boost::optional<std::string> optionalField(const std::string& str) {
+    if (str.empty() || (str.front() != '+' && str.front() != '-')) {
+        throw Error("Invalid format of the message manifest");
+    }
+    if (str.front() == '-') {
+        return boost::none;
+    }
+    return str.substr(1);
+}
+
+} // namespace
+
+std::string msgIdSymbol(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    std::ostringstream s;
+    s << MSG_ID_SYMBOL_PREFIX << std::hex << std::setw(16) << std::setfill('0')
+            << MsgIndex::keyHash(fmtStr, hintMsg, helpId);
+    return s.str();
+}
+
+void ManifestWriter::add(const std::string& symbol, const std::string& fmtStr,
+        const boost::optional<std::string>& hintMsg, const boost::optional<std::string>& helpId,
+        const std::string& srcFile, unsigned srcLine) {
+    appendField(&data_, MANIFEST_VERSION);
+    appendField(&data_, symbol);
+    appendField(&data_, fmtStr);
+    appendField(&data_, hintMsg);
+    appendField(&data_, helpId);
+    appendField(&data_, srcFile);
+    appendField(&data_, toStr(srcLine));
+}
+
+std::string ManifestWriter::asmStr() const {
+    // Use a non-allocatable section, so that the manifest doesn't end up in the program image
+    std::ostringstream s;
+    s << "\t.pushsection " << MSG_MANIFEST_SECTION << ",\"\",%progbits\n";
+    s << "\t.ascii \"";
+    s << std::oct << std::setfill('0');
+    for (size_t i = 0; i < data_.size(); ++i) {
+        const unsigned char c = data_.at(i);
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            s << c;
+        } else {
+            s << '\\' << std::setw(3) << (unsigned)c;
+        }
+        if (i % 64 == 63 && i + 1 < data_.size()) {
+            s << "\"\n\t.ascii \"";
+        }
+    }
+    s << "\"\n";
+    s << "\t.popsection\n";
+    return s.str();
+}
+
+void ManifestWriter::appendToFile(const std::string& file) const {
+    if (data_.empty()) {
+        return;
+    }
+    const int fd = ::open(file.data(), O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (fd < 0) {
+        throw Error("Unable to open manifest file: %s: %s", file, std::strerror(errno));
+    }
+    const ssize_t n = ::write(fd, data_.data(), data_.size());
+    const int err = errno;
+    ::close(fd);
+    if (n != (ssize_t)data_.size()) {
+        throw Error("Unable to write manifest file: %s: %s", file, (n < 0) ? std::strerror(err) : "Short write");
+    }
+}
+
+void ManifestReader::parse(const std::string& data) {
+    std::vector<std::string> fields;
+    fields.reserve(MANIFEST_FIELD_COUNT);
+    size_t pos = 0;
+    while (pos < data.size()) {
+        if (data.at(pos) == '\0' && fields.empty()) {
+            ++pos; // Skip section padding
+            continue;
+        }
+        const size_t end = data.find('\0', pos);
+        if (end == std::string::npos) {
+            throw Error("Invalid format of the message manifest");
+        }
+        fields.push_back(data.substr(pos, end - pos));
+        pos = end + 1;
+        if (fields.front() != MANIFEST_VERSION) {
+            throw Error("Unsupported version of the message manifest: %s", fields.front());
+        }
+        if (fields.size() == MANIFEST_FIELD_COUNT) {
+            handler_(fields.at(1), fields.at(2), optionalField(fields.at(3)), optionalField(fields.at(4)),
+                    fields.at(5), fromStr<unsigned>(fields.at(6)));
+            fields.clear();
+        }
+    }
+    if (!fields.empty()) {
+        throw Error("Invalid format of the message manifest");
+    }
+}
+
+void ManifestMsgList::parse(const std::string& data) {
+    ManifestReader reader([this](const std::string& symbol, const std::string& fmtStr,
+            const boost::optional<std::string>& hintMsg, const boost::optional<std::string>& helpId,
+            const std::string& srcFile, unsigned srcLine) {
+        ManifestMsg msg;
+        msg.symbol = symbol;
+        msg.fmt = fmtStr;
+        msg.hint = hintMsg ? *hintMsg : std::string();
+        msg.help = helpId ? *helpId : std::string();
+        msg.file = srcFile;
+        msg.line = srcLine;
+        const auto it = symbols_.find(symbol);
+        if (it == symbols_.end()) {
+            msgs_.push_back(std::move(msg));
+            symbols_.insert(std::make_pair(symbol, &msgs_.back()));
+        } else if (it->second->fmt != msg.fmt || it->second->hint != msg.hint || it->second->help != msg.help) {
+            throw Error("%s:%u: Conflicting message symbol: %s", srcFile, srcLine, symbol);
+        }
+    });
+    reader.parse(data);
+}
+
+} // namespace particle
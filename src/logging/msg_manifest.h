@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/msg_index.h"
+#include "common.h"
+
+#include <list>
+#include <map>
+
+namespace particle {
+
+// Name of the ELF section containing the message manifest of an object file
+const std::string MSG_MANIFEST_SECTION = ".particle.msgs";
+
+// Returns name of the symbol, which address is used as a message ID in the link-time mode
+std::string msgIdSymbol(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId);
+
+// Generator of the message manifest. The manifest lists all messages of a translation unit along with the
+// symbols representing their IDs, so that the IDs can be assigned at link time
+class ManifestWriter {
+public:
+    ManifestWriter();
+
+    void add(const std::string& symbol, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId, const std::string& srcFile, unsigned srcLine);
+
+    // Returns assembler code defining the manifest section
+    std::string asmStr() const;
+
+    // Appends the manifest to a file. The data is written with a single write() call, so that multiple processes
+    // can append to the same file concurrently
+    void appendToFile(const std::string& file) const;
+
+    const std::string& data() const;
+    bool isEmpty() const;
+
+private:
+    std::string data_;
+};
+
+// Parser for the message manifest
+class ManifestReader {
+public:
+    typedef std::function<void(const std::string& symbol, const std::string& fmtStr,
+            const boost::optional<std::string>& hintMsg, const boost::optional<std::string>& helpId,
+            const std::string& srcFile, unsigned srcLine)> Handler;
+
+    explicit ManifestReader(Handler handler);
+
+    // Parses the contents of a manifest section. Sections of multiple object files can be concatenated
+    void parse(const std::string& data);
+
+private:
+    Handler handler_;
+};
+
+// Message read from a manifest
+class ManifestMsg: public MsgIndex::Msg {
+public:
+    std::string symbol, fmt, hint, help, file;
+    unsigned line;
+    MsgId id;
+
+    ManifestMsg() :
+            line(0),
+            id(INVALID_MSG_ID) {
+    }
+
+    // Reimplemented from `MsgIndex::Msg`
+    virtual void msgId(MsgId id) override {
+        this->id = id;
+    }
+
+    virtual MsgId msgId() const override {
+        return id;
+    }
+
+    virtual const std::string& fmtStr() const override {
+        return fmt;
+    }
+
+    virtual const std::string& hintMsg() const override {
+        return hint;
+    }
+
+    virtual const std::string& helpId() const override {
+        return help;
+    }
+
+    virtual std::string srcFile() const override {
+        return file;
+    }
+
+    virtual unsigned srcLine() const override {
+        return line;
+    }
+};
+
+// List of unique messages collected from one or more manifests
+class ManifestMsgList {
+public:
+    ManifestMsgList();
+
+    // Parses the contents of a manifest section. Messages sharing the same symbol are merged
+    void parse(const std::string& data);
+
+    const ManifestMsg* find(const std::string& symbol) const;
+
+    std::list<ManifestMsg>& msgs();
+    const std::list<ManifestMsg>& msgs() const;
+
+    // Returns all messages ordered by their symbols
+    const std::map<std::string, const ManifestMsg*>& symbols() const;
+
+private:
+    std::list<ManifestMsg> msgs_;
+    std::map<std::string, const ManifestMsg*> symbols_;
+};
+
+inline ManifestWriter::ManifestWriter() {
+}
+
+inline const std::string& ManifestWriter::data() const {
+    return data_;
+}
+
+inline bool ManifestWriter::isEmpty() const {
+    return data_.empty();
+}
+
+inline ManifestReader::ManifestReader(Handler handler) :
+        handler_(std::move(handler)) {
+}
+
+inline ManifestMsgList::ManifestMsgList() {
+}
+
+inline const ManifestMsg* ManifestMsgList::find(const std::string& symbol) const {
+    const auto it = symbols_.find(symbol);
+    return (it != symbols_.end()) ? it->second : nullptr;
+}
+
+inline std::list<ManifestMsg>& ManifestMsgList::msgs() {
+    return msgs_;
+}
+
+inline const std::list<ManifestMsg>& ManifestMsgList::msgs() const {
+    return msgs_;
+}
+
+inline const std::map<std::string, const ManifestMsg*>& ManifestMsgList::symbols() const {
+    return symbols_;
+}
+
+} // namespace particle
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/msg_server.h"
+
+#include "error.h"
+#include "debug.h"
+
+#include <list>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is used instead
+#endif
+
+namespace particle {
+
+namespace {
+
+// Protocol definitions. All integers are sent in host byte order
+const uint32_t PROTOCOL_VERSION = 1;
+
+enum ResponseStatus {
+    RESPONSE_OK = 0,
+    RESPONSE_ERROR = 1
+};
+
+enum MsgFlag {
+    HAS_HINT_MSG = 0x01,
+    HAS_HELP_ID = 0x02
+};
+
+// Maximum number of messages in a single request
+const uint32_t MAX_MSG_COUNT = 1000000;
+
+// Maximum size of a string in a request
+const uint32_t MAX_STR_SIZE = 1024 * 1024;
+
+// Client timeout for sending/receiving data (seconds)
+const unsigned CLIENT_TIMEOUT = 60;
+
+// Server timeout for sending/receiving data (seconds)
+const unsigned SERVER_TIMEOUT = 10;
+
+// Maximum number of clients processed concurrently by the server
+const unsigned MAX_CLIENT_COUNT = 64;
+
+bool writeData(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        // The client runs inside the compiler process, so a closed connection should not raise SIGPIPE
+        const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false; // EPIPE and other errors are treated as a connection failure
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readData(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::recv(fd, p, size, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool readUint(int fd, uint32_t* val) {
+    return readData(fd, val, sizeof(uint32_t));
+}
+
+bool readStr(int fd, std::string* str) {
+    uint32_t size = 0;
+    if (!readUint(fd, &size) || size > MAX_STR_SIZE) {
+        return false;
+    }
+    str->resize(size);
+    return (size == 0 || readData(fd, &str->at(0), size));
+}
+
+void appendUint(std::string* data, uint32_t val) {
+    data->append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+void appendStr(std::string* data, const std::string& str) {
+    appendUint(data, str.size());
+    data->append(str);
+}
+
+void setSocketOptions(int fd, unsigned timeout) {
+    timeval tv = timeval();
+    tv.tv_sec = timeout;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+    const int val = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &val, sizeof(val));
+#endif
+}
+
+sockaddr_un socketAddr(const std::string& file) {
+    sockaddr_un addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if (file.size() >= sizeof(addr.sun_path)) {
+        throw Error("Socket path is too long: %s", file);
+    }
+    std::strncpy(addr.sun_path, file.data(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+} // namespace
+
+class MsgServer::Msg: public MsgIndex::Msg {
+public:
+    std::string fmt, hint, help, key;
+    MsgId id;
+
+    Msg() :
+            id(INVALID_MSG_ID) {
+    }
+
+    // Reimplemented from `MsgIndex::Msg`
+    virtual void msgId(MsgId id) override {
+        this->id = id;
+    }
+
+    virtual MsgId msgId() const override {
+        return id;
+    }
+
+    virtual const std::string& fmtStr() const override {
+        return fmt;
+    }
+
+    virtual const std::string& hintMsg() const override {
+        return hint;
+    }
+
+    virtual const std::string& helpId() const override {
+        return help;
+    }
+
+    virtual std::string srcFile() const override {
+        return std::string();
+    }
+
+    virtual unsigned srcLine() const override {
+        return 0;
+    }
+};
+
+MsgServer::MsgServer(const std::string& socketFile, const std::string& destFile,
+        const std::vector<std::string>& srcFiles) :
+        msgIndex_(destFile, srcFiles),
+        socketFile_(socketFile),
+        clientCount_(0),
+        fd_(-1),
+        stop_(false) {
+    const sockaddr_un addr = socketAddr(socketFile_);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0) {
+        throw Error("Unable to create socket: %s", std::strerror(errno));
+    }
+    ::unlink(socketFile_.data()); // Remove stale socket file
+    if (::bind(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd_, SOMAXCONN) != 0) {
+        const int err = errno;
+        ::close(fd_);
+        throw Error("Unable to bind socket: %s: %s", socketFile_, std::strerror(err));
+    }
+}
+
+MsgServer::~MsgServer() {
+    waitClients(0);
+    ::close(fd_);
+    ::unlink(socketFile_.data());
+}
+
+void MsgServer::run() {
+    DEBUG("Listening on %s", socketFile_);
+    while (!stop_) {
+        waitClients(MAX_CLIENT_COUNT - 1);
+        const int fd = ::accept(fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw Error("Unable to accept connection: %s", std::strerror(errno));
+        }
+        setSocketOptions(fd, SERVER_TIMEOUT);
+        // Each client is processed in a separate thread, so that a stalled client doesn't block other
+        // compiler processes. Signals are blocked in the client threads, so that they interrupt accept()
+        sigset_t sigMask, oldSigMask;
+        sigfillset(&sigMask);
+        pthread_sigmask(SIG_SETMASK, &sigMask, &oldSigMask);
+        try {
+            std::lock_guard<std::mutex> lock(clientMutex_);
+            std::thread(&MsgServer::runClient, this, fd).detach();
+            ++clientCount_;
+        } catch (const std::exception& e) {
+            DEBUG("Unable to start client thread: %s", e.what());
+            ::close(fd);
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSigMask, nullptr);
+    }
+    waitClients(0);
+}
+
+void MsgServer::runClient(int fd) {
+    try {
+        processRequest(fd);
+    } catch (const std::exception& e) {
+        DEBUG("Unable to process request: %s", e.what());
+    }
+    ::close(fd);
+    std::lock_guard<std::mutex> lock(clientMutex_);
+    --clientCount_;
+    clientCond_.notify_all();
+}
+
+void MsgServer::waitClients(unsigned maxCount) {
+    std::unique_lock<std::mutex> lock(clientMutex_);
+    clientCond_.wait(lock, [this, maxCount]() {
+        return clientCount_ <= maxCount;
+    });
+}
+
+void MsgServer::processRequest(int fd) {
+    uint32_t ver = 0, msgCount = 0;
+    if (!readUint(fd, &ver) || ver != PROTOCOL_VERSION || !readUint(fd, &msgCount) || msgCount > MAX_MSG_COUNT) {
+        return; // Invalid request
+    }
+    // Read the entire request before locking the message index
+    std::list<Msg> msgs;
+    for (uint32_t i = 0; i < msgCount; ++i) {
+        msgs.push_back(Msg());
+        Msg& msg = msgs.back();
+        uint32_t flags = 0;
+        if (!readUint(fd, &flags) || !readStr(fd, &msg.fmt) || ((flags & HAS_HINT_MSG) && !readStr(fd, &msg.hint)) ||
+                ((flags & HAS_HELP_ID) && !readStr(fd, &msg.help))) {
+            return; // Invalid request
+        }
+        // Serialized message attributes are used as a key in the map of known messages
+        appendUint(&msg.key, flags);
+        appendStr(&msg.key, msg.fmt);
+        appendStr(&msg.key, msg.hint);
+        appendStr(&msg.key, msg.help);
+    }
+    std::string resp;
+    try {
+        std::lock_guard<std::mutex> lock(msgMutex_);
+        std::vector<MsgId> msgIds(msgCount, INVALID_MSG_ID);
+        std::list<Msg> newMsgs;
+        std::vector<uint32_t> newMsgIndices;
+        uint32_t i = 0;
+        for (auto it = msgs.begin(); it != msgs.end(); ++i) {
+            const auto id = msgIds_.find(it->key);
+            if (id != msgIds_.end()) {
+                msgIds[i] = id->second;
+                ++it;
+            } else {
+                newMsgs.splice(newMsgs.end(), msgs, it++);
+                newMsgIndices.push_back(i);
+            }
+        }
+        if (!newMsgs.empty()) {
+            msgIndex_.process(newMsgs.begin(), newMsgs.end());
+            auto index = newMsgIndices.begin();
+            for (const Msg& msg: newMsgs) {
+                msgIds[*index++] = msg.id;
+                msgIds_[msg.key] = msg.id;
+            }
+            DEBUG("Processed %u messages", (unsigned)newMsgs.size());
+        }
+        appendUint(&resp, RESPONSE_OK);
+        for (MsgId id: msgIds) {
+            appendUint(&resp, id);
+        }
+    } catch (const std::exception& e) {
+        resp.clear();
+        appendUint(&resp, RESPONSE_ERROR);
+        appendStr(&resp, e.what());
+    }
+    writeData(fd, resp.data(), resp.size());
+}
+
+MsgClient::MsgClient() :
+        msgCount_(0),
+        fd_(-1) {
+}
+
+bool MsgClient::connect(const std::string& socketFile) {
+    close();
+    const sockaddr_un addr = socketAddr(socketFile);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0) {
+        return false;
+    }
+    if (::connect(fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        DEBUG("Unable to connect to message server: %s", std::strerror(errno));
+        close();
+        return false;
+    }
+    setSocketOptions(fd_, CLIENT_TIMEOUT);
+    return true;
+}
+
+void MsgClient::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    data_.clear();
+    msgCount_ = 0;
+}
+
+void MsgClient::add(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    unsigned flags = 0;
+    if (hintMsg) {
+        flags |= HAS_HINT_MSG;
+    }
+    if (helpId) {
+        flags |= HAS_HELP_ID;
+    }
+    appendUint(&data_, flags);
+    appendStr(&data_, fmtStr);
+    if (hintMsg) {
+        appendStr(&data_, *hintMsg);
+    }
+    if (helpId) {
+        appendStr(&data_, *helpId);
+    }
+    ++msgCount_;
+}
+
+bool MsgClient::send(std::vector<MsgId>* msgIds) {
+    assert(fd_ >= 0);
+    std::string req;
+    appendUint(&req, PROTOCOL_VERSION);
+    appendUint(&req, msgCount_);
+    if (!writeData(fd_, req.data(), req.size()) || !writeData(fd_, data_.data(), data_.size())) {
+        return false;
+    }
+    uint32_t status = 0;
+    if (!readUint(fd_, &status)) {
+        return false;
+    }
+    if (status != RESPONSE_OK) {
+        std::string msg;
+        if (!readStr(fd_, &msg)) {
+            return false;
+        }
+        throw Error("Message server error: %s", msg);
+    }
+    std::vector<MsgId> ids(msgCount_, INVALID_MSG_ID);
+    if (msgCount_ > 0 && !readData(fd_, ids.data(), ids.size() * sizeof(MsgId))) {
+        return false;
+    }
+    msgIds->swap(ids);
+    return true;
+}
+
+} // namespace particle
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/msg_index.h"
+#include "common.h"
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace particle {
+
+// Server process assigning message IDs on behalf of the compiler processes. The server keeps the known
+// messages in memory and updates the destination message file only when new messages appear. Clients
+// are processed concurrently, while the message index is updated by one client at a time
+class MsgServer {
+public:
+    MsgServer(const std::string& socketFile, const std::string& destFile, const std::vector<std::string>& srcFiles);
+    ~MsgServer();
+
+    // Processes client requests until stop() is called
+    void run();
+    void stop();
+
+private:
+    class Msg;
+
+    MsgIndex msgIndex_;
+    std::unordered_map<std::string, MsgId> msgIds_; // Known messages
+    std::mutex msgMutex_; // Guards the message index and the map of known messages
+    std::string socketFile_;
+    std::mutex clientMutex_;
+    std::condition_variable clientCond_;
+    unsigned clientCount_; // Number of running client threads
+    int fd_;
+    volatile bool stop_;
+
+    void runClient(int fd);
+    void waitClients(unsigned maxCount);
+    void processRequest(int fd);
+};
+
+// Client for the message server
+class MsgClient {
+public:
+    MsgClient();
+    ~MsgClient();
+
+    // Connects to the server. Returns false if the server is not running
+    bool connect(const std::string& socketFile);
+    void close();
+
+    void add(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId);
+
+    // Sends all added messages to the server and returns their IDs. Returns false in case of an I/O error
+    bool send(std::vector<MsgId>* msgIds);
+
+private:
+    std::string data_;
+    unsigned msgCount_;
+    int fd_;
+};
+
+inline void MsgServer::stop() {
+    stop_ = true;
+}
+
+inline MsgClient::~MsgClient() {
+    close();
+}
+
+} // namespace particle
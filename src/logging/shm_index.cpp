@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/shm_index.h"
+
+#include "error.h"
+#include "debug.h"
+
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ipc = boost::interprocess;
+namespace fs = boost::filesystem;
+
+namespace particle {
+
+namespace {
+
+// Note: The segment is accessed by processes built from the same plugin binary, so the native byte order
+// and structure layout are used
+const char SHM_MAGIC[8] = { 'P', 'M', 'S', 'G', 'S', 'H', 'M', '\0' };
+const uint32_t SHM_VERSION = 4;
+
+// Capacity of the segment. Pages of a shared memory object are allocated on demand, so the segment doesn't
+// occupy that much memory unless it's actually used
+const uint32_t SHM_DEFAULT_MSG_COUNT = 128 * 1024;
+const uint32_t SHM_STR_SIZE_PER_MSG = 384; // Average size of the message attributes the segment is sized for
+
+// Lock timeout (milliseconds)
+const unsigned SHM_LOCK_TIMEOUT = 10000;
+
+std::string msgKey(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    std::string key(fmtStr.data(), fmtStr.size() + 1); // Include term. null
+    key += hintMsg ? '+' + *hintMsg : std::string("-");
+    key += '\0';
+    key += helpId ? '+' + *helpId : std::string("-");
+    return key;
+}
+
+boost::posix_time::ptime lockDeadline() {
+    return boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(SHM_LOCK_TIMEOUT);
+}
+
+// The segment is guarded by a lock file rather than by a mutex stored in the segment itself. POSIX record locks
+// are released by the system when the owning process dies, so a compiler process killed while holding the lock
+// doesn't leave the segment locked until it's removed
+std::string lockFileName(const std::string& name) {
+    return (fs::temp_directory_path() / ("particle_shm_" + name + ".lock")).string();
+}
+
+// Keep the load factor of the hash table below 0.5
+uint32_t bucketCount(uint32_t maxMsgCount) {
+    uint32_t n = 16;
+    while (n < maxMsgCount * 2) {
+        n *= 2;
+    }
+    return n;
+}
+
+} // namespace
+
+struct ShmIndex::Header {
+    char magic[8];
+    uint32_t version;
+    std::atomic<uint32_t> ready; // Set to 1 when the segment is initialized
+    uint32_t maxMsgCount;
+    uint32_t bucketCount; // Power of 2
+    uint32_t strCapacity;
+    uint32_t full; // Set to 1 when the message file doesn't fit in the segment
+    MsgFileStamp stamp;
+    uint32_t msgCount;
+    uint32_t strSize;
+};
+
+// Hash table entry. An entry with `msgId` set to INVALID_MSG_ID is empty
+struct ShmIndex::Entry {
+    uint64_t hash;
+    uint32_t keyOffs, keySize;
+    uint32_t msgId;
+    uint32_t reserved;
+};
+
+ShmIndex::ShmIndex(const std::string& name, unsigned maxMsgCount) :
+        name_(name),
+        maxMsgCount_(maxMsgCount ? maxMsgCount : SHM_DEFAULT_MSG_COUNT),
+        header_(nullptr),
+        entries_(nullptr),
+        strs_(nullptr) {
+}
+
+ShmIndex::~ShmIndex() {
+}
+
+bool ShmIndex::open() {
+    try {
+        const std::string lockFile = lockFileName(name_);
+        const int fd = ::open(lockFile.data(), O_RDWR | O_CREAT, 0666);
+        if (fd < 0) {
+            throw Error("Unable to create lock file: %s: %s", lockFile, std::strerror(errno));
+        }
+        ::close(fd);
+        lock_ = ipc::file_lock(lockFile.data());
+        // The segment is created and initialized with an exclusive lock acquired, so a segment left uninitialized
+        // by a process that died while creating it is initialized by the next process opening it
+        if (!lock_.timed_lock(lockDeadline())) {
+            throw Error("Unable to lock shared memory segment");
+        }
+        try {
+            if (!attach()) {
+                // The segment has been created by an incompatible version of the plugin, or with a smaller capacity
+                DEBUG("Recreating shared memory segment: %s", name_);
+                detach();
+                ipc::shared_memory_object::remove(name_.data());
+                if (!attach()) {
+                    throw Error("Unsupported format of the shared memory segment");
+                }
+            }
+        } catch (...) {
+            lock_.unlock();
+            throw;
+        }
+        lock_.unlock();
+    } catch (const std::exception& e) {
+        DEBUG("Unable to open shared memory segment: %s: %s", name_, e.what());
+        detach();
+        return false;
+    }
+    return true;
+}
+
+bool ShmIndex::attach() {
+    const uint32_t buckets = bucketCount(maxMsgCount_);
+    const uint64_t strCapacity = (uint64_t)maxMsgCount_ * SHM_STR_SIZE_PER_MSG;
+    const uint64_t segmentSize = sizeof(Header) + (uint64_t)buckets * sizeof(Entry) + strCapacity;
+    shm_ = ipc::shared_memory_object(ipc::open_or_create, name_.data(), ipc::read_write);
+    ipc::offset_t size = 0;
+    if (!shm_.get_size(size) || (uint64_t)size < sizeof(Header)) {
+        shm_.truncate(segmentSize); // New segment
+    }
+    region_ = ipc::mapped_region(shm_, ipc::read_write, 0, sizeof(Header));
+    header_ = static_cast<Header*>(region_.get_address());
+    if (header_->ready.load(std::memory_order_acquire) == 0) {
+        // The segment is not initialized. The truncated object is filled with zeros, but a partially initialized
+        // segment may contain entries
+        shm_.truncate(segmentSize);
+        region_ = ipc::mapped_region(shm_, ipc::read_write, 0, segmentSize);
+        header_ = static_cast<Header*>(region_.get_address());
+        std::memcpy(header_->magic, SHM_MAGIC, sizeof(header_->magic));
+        header_->version = SHM_VERSION;
+        header_->maxMsgCount = maxMsgCount_;
+        header_->bucketCount = buckets;
+        header_->strCapacity = strCapacity;
+        header_->full = 0;
+        mapEntries();
+        clear();
+        header_->ready.store(1, std::memory_order_release);
+        return true;
+    }
+    if (std::memcmp(header_->magic, SHM_MAGIC, sizeof(header_->magic)) != 0 || header_->version != SHM_VERSION ||
+            header_->maxMsgCount < maxMsgCount_) {
+        return false;
+    }
+    const uint64_t existingSize = sizeof(Header) + (uint64_t)header_->bucketCount * sizeof(Entry) +
+            header_->strCapacity;
+    if (!shm_.get_size(size) || (uint64_t)size != existingSize) {
+        return false;
+    }
+    region_ = ipc::mapped_region(shm_, ipc::read_write, 0, existingSize);
+    header_ = static_cast<Header*>(region_.get_address());
+    mapEntries();
+    return true;
+}
+
+void ShmIndex::mapEntries() {
+    char* const data = reinterpret_cast<char*>(header_);
+    entries_ = reinterpret_cast<Entry*>(data + sizeof(Header));
+    strs_ = data + sizeof(Header) + (size_t)header_->bucketCount * sizeof(Entry);
+}
+
+void ShmIndex::detach() {
+    header_ = nullptr;
+    entries_ = nullptr;
+    strs_ = nullptr;
+    region_ = ipc::mapped_region();
+    shm_ = ipc::shared_memory_object();
+}
+
+bool ShmIndex::lockSharable() {
+    assert(header_);
+    return lock_.timed_lock_sharable(lockDeadline());
+}
+
+void ShmIndex::unlockSharable() {
+    assert(header_);
+    lock_.unlock_sharable();
+}
+
+bool ShmIndex::lock() {
+    assert(header_);
+    return lock_.timed_lock(lockDeadline());
+}
+
+void ShmIndex::unlock() {
+    assert(header_);
+    lock_.unlock();
+}
+
+MsgId ShmIndex::find(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) const {
+    assert(header_);
+    const uint64_t hash = MsgIndex::keyHash(fmtStr, hintMsg, helpId);
+    const std::string key = msgKey(fmtStr, hintMsg, helpId);
+    const uint32_t mask = header_->bucketCount - 1;
+    // Linear probing
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        const Entry& e = entries_[i];
+        if (e.msgId == INVALID_MSG_ID) {
+            break; // Empty bucket
+        }
+        if (e.hash == hash && e.keySize == key.size() && (uint64_t)e.keyOffs + e.keySize <= header_->strSize &&
+                std::memcmp(strs_ + e.keyOffs, key.data(), key.size()) == 0) {
+            return e.msgId;
+        }
+    }
+    return INVALID_MSG_ID;
+}
+
+bool ShmIndex::add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+        const boost::optional<std::string>& helpId) {
+    assert(header_ && id != INVALID_MSG_ID);
+    const uint64_t hash = MsgIndex::keyHash(fmtStr, hintMsg, helpId);
+    const std::string key = msgKey(fmtStr, hintMsg, helpId);
+    const uint32_t mask = header_->bucketCount - 1;
+    uint32_t i = hash & mask;
+    for (;; i = (i + 1) & mask) {
+        Entry& e = entries_[i];
+        if (e.msgId == INVALID_MSG_ID) {
+            break;
+        }
+        if (e.hash == hash && e.keySize == key.size() && std::memcmp(strs_ + e.keyOffs, key.data(), key.size()) == 0) {
+            e.msgId = id; // Update existing entry
+            return true;
+        }
+    }
+    if (header_->msgCount >= header_->maxMsgCount || key.size() > header_->strCapacity - header_->strSize) {
+        DEBUG("Shared memory segment is full: %s", name_);
+        return false;
+    }
+    Entry& e = entries_[i];
+    e.hash = hash;
+    e.keyOffs = header_->strSize;
+    e.keySize = key.size();
+    std::memcpy(strs_ + e.keyOffs, key.data(), key.size());
+    header_->strSize += key.size();
+    ++header_->msgCount;
+    e.msgId = id;
+    return true;
+}
+
+void ShmIndex::clear() {
+    assert(header_);
+    std::memset(entries_, 0, (size_t)header_->bucketCount * sizeof(Entry));
+    header_->msgCount = 0;
+    header_->strSize = 0;
+    header_->stamp = MsgFileStamp();
+}
+
+bool ShmIndex::isUpToDate(const MsgFileStamp& stamp) const {
+    assert(header_);
+    return (header_->stamp == stamp);
+}
+
+void ShmIndex::stamp(const MsgFileStamp& stamp) {
+    assert(header_);
+    header_->stamp = stamp;
+}
+
+bool ShmIndex::isFull() const {
+    assert(header_);
+    return header_->full;
+}
+
+void ShmIndex::markFull() {
+    assert(header_);
+    clear();
+    header_->full = 1;
+}
+
+void ShmIndex::remove(const std::string& name) {
+    ipc::shared_memory_object::remove(name.data());
+    boost::system::error_code ec;
+    fs::remove(lockFileName(name), ec);
+}
+
+} // namespace particle
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "logging/bin_index.h"
+#include "common.h"
+
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+
+namespace particle {
+
+// Index of known messages stored in a named shared memory segment. The segment is shared by all compiler
+// processes using the same destination message file, so that the file needs to be loaded only once. The index
+// doesn't assign message IDs by itself and only caches the contents of the message file
+class ShmIndex {
+public:
+    // `maxMsgCount` is the maximum number of messages the segment can hold if it needs to be created
+    // (128K by default). An existing segment with a smaller capacity is recreated
+    explicit ShmIndex(const std::string& name, unsigned maxMsgCount = 0);
+    ~ShmIndex();
+
+    // Attaches to the segment, creating it if necessary. A segment created by an incompatible version of
+    // the plugin is recreated. Returns false if the segment is not available
+    bool open();
+
+    // Acquire and release the lock protecting the index. The lock is released automatically if the process
+    // holding it dies. Returns false if the lock can't be acquired in a reasonable amount of time
+    bool lockSharable();
+    void unlockSharable();
+    bool lock();
+    void unlock();
+
+    // Returns ID of a message or INVALID_MSG_ID if the message is not found. Called with a lock acquired
+    MsgId find(const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId) const;
+
+    // Adds a message to the index. Returns false if the segment is full. Called with an exclusive lock acquired
+    bool add(MsgId id, const std::string& fmtStr, const boost::optional<std::string>& hintMsg,
+            const boost::optional<std::string>& helpId);
+
+    // Removes all messages from the index. Called with an exclusive lock acquired
+    void clear();
+
+    // Returns true if the index reflects the given state of the message file
+    bool isUpToDate(const MsgFileStamp& stamp) const;
+    void stamp(const MsgFileStamp& stamp);
+
+    // Returns true if the message file didn't fit in the segment. Such a segment is not used until it's removed
+    // or recreated with a larger capacity. Called with a lock acquired
+    bool isFull() const;
+    // Removes all messages from the index and marks it as full. Called with an exclusive lock acquired
+    void markFull();
+
+    // Removes the segment and its lock file
+    static void remove(const std::string& name);
+
+private:
+    struct Header;
+    struct Entry;
+
+    boost::interprocess::shared_memory_object shm_;
+    boost::interprocess::mapped_region region_;
+    boost::interprocess::file_lock lock_;
+    std::string name_;
+    unsigned maxMsgCount_;
+    Header* header_;
+    Entry* entries_;
+    char* strs_;
+
+    bool attach();
+    void detach();
+    void mapEntries();
+};
+
+} // namespace particle
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging/msg_server.h"
+#include "logging/msg_manifest.h"
+#include "logging/msg_index.h"
+#include "logging/shm_index.h"
+#include "util/elf.h"
+#include "error.h"
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <csignal>
+
+namespace {
+
+using namespace particle;
+
+MsgServer* g_server = nullptr;
+
+void signalHandler(int) {
+    if (g_server) {
+        g_server->stop();
+    }
+}
+
+void printUsage(const char* name) {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  " << name << " server <socket> <dest-msg-file> [<src-msg-file>...]" << std::endl;
+    std::cerr << "  " << name << " compact <dest-msg-file>" << std::endl;
+    std::cerr << "  " << name << " link <dest-msg-file> <out-ld-script> <obj-file>..." << std::endl;
+    std::cerr << "  " << name << " shm-remove <segment-name>" << std::endl;
+    std::cerr << "  " << name << " prewarm <manifest-file> <dest-msg-file> [<src-msg-file>...]" << std::endl;
+}
+
+void runServer(const std::vector<std::string>& args) {
+    const std::vector<std::string> srcFiles(args.begin() + 2, args.end());
+    MsgServer server(args.at(0), args.at(1), srcFiles);
+    g_server = &server;
+    // Interrupt blocking calls on termination signals
+    struct sigaction sa = {};
+    sa.sa_handler = signalHandler;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    server.run();
+    g_server = nullptr;
+}
+
+void compact(const std::vector<std::string>& args) {
+    MsgIndex msgIndex(args.at(0));
+    msgIndex.compact();
+}
+
+// Assigns IDs to the messages listed in the manifests of the object files and generates a linker script
+// defining the message ID symbols
+void link(const std::vector<std::string>& args) {
+    ManifestMsgList msgs;
+    for (auto it = args.begin() + 2; it != args.end(); ++it) {
+        for (const std::string& data: readElfSections(*it, MSG_MANIFEST_SECTION)) {
+            msgs.parse(data);
+        }
+    }
+    MsgIndex msgIndex(args.at(0));
+    msgIndex.process(msgs.msgs().begin(), msgs.msgs().end());
+    std::ofstream strm;
+    strm.exceptions(std::ios::badbit | std::ios::failbit); // Enable exceptions
+    strm.open(args.at(1), std::ios::out | std::ios::trunc);
+    strm << "/* Generated by particle_msg_tool. Do not edit */\n";
+    for (const auto& sym: msgs.symbols()) {
+        strm << sym.first << " = " << sym.second->id << ";\n";
+    }
+    strm.close();
+}
+
+// Assigns IDs to the messages collected by the plugin in the prewarm mode
+void prewarm(const std::vector<std::string>& args) {
+    std::ifstream strm;
+    strm.exceptions(std::ios::badbit); // Enable exceptions
+    strm.open(args.at(0), std::ios::in | std::ios::binary);
+    if (!strm.is_open()) {
+        throw Error("Unable to open manifest file: %s", args.at(0));
+    }
+    ManifestMsgList msgs;
+    msgs.parse(std::string(std::istreambuf_iterator<char>(strm), std::istreambuf_iterator<char>()));
+    const std::vector<std::string> srcFiles(args.begin() + 2, args.end());
+    MsgIndex msgIndex(args.at(1), srcFiles);
+    msgIndex.process(msgs.msgs().begin(), msgs.msgs().end());
+    std::cout << "Processed " << msgs.msgs().size() << " messages" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const std::string cmd = (argc > 1) ? argv[1] : std::string();
+    const std::vector<std::string> args(argv + std::min(argc, 2), argv + argc);
+    try {
+        if (cmd == "server" && args.size() >= 2) {
+            runServer(args);
+        } else if (cmd == "compact" && args.size() == 1) {
+            compact(args);
+        } else if (cmd == "link" && args.size() >= 2) {
+            link(args);
+        } else if (cmd == "prewarm" && args.size() >= 2) {
+            prewarm(args);
+        } else if (cmd == "shm-remove" && args.size() == 1) {
+            ShmIndex::remove(args.at(0));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
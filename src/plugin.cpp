@@ -18,6 +18,7 @@
 #include "plugin.h"
 
 #include "logging/log_pass.h"
+#include "logging/log_summary_pass.h"
 #include "util/string.h"
 #include "error.h"
 #include "debug.h"
@@ -52,6 +53,17 @@ void particle::Plugin::init() {
     registerPass(logPass_.get(), PassRegInfo()
             .runBefore("*free_lang_data")
             .refPassInstanceNum(1)); // Just in case
+    if (logPass_->summaryPass()) {
+        // Message IDs are assigned after the inlining decisions are made, so that the messages of the removed
+        // functions are not added to the message file
+        registerPass(logPass_->summaryPass(), PassRegInfo()
+                .runAfter("inline")
+                .refPassInstanceNum(1));
+    }
+}
+
+void particle::Plugin::beginUnit() {
+    logPass_->beginUnit();
 }
 
 void particle::Plugin::attrHandler(tree t, std::vector<Variant> args) {
@@ -27,6 +27,7 @@ class LogPass;
 class Plugin: public PluginBase {
 protected:
     virtual void init() override;
+    virtual void beginUnit() override;
 
 private:
     std::unique_ptr<LogPass> logPass_;
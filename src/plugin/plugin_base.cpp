@@ -110,6 +110,10 @@ void particle::PluginBase::defineMacro(const std::string& name) {
     macros_.push_back(name);
 }
 
+void particle::PluginBase::beginUnit() {
+    // Default implementation does nothing
+}
+
 gcc::context* particle::PluginBase::gccContext() {
     return g; // Defined in context.h
 }
@@ -123,6 +127,7 @@ void particle::PluginBase::startUnit(void* gccData, void* userData) {
             cpp_define(parse_in, macro.data());
         }
         p->macros_.clear(); // Not needed anymore
+        p->beginUnit();
     } catch (const std::exception& e) {
         error(e.what());
     }
@@ -63,6 +63,9 @@ public:
 protected:
     virtual void init() = 0;
 
+    // Called at the start of a translation unit, before it's parsed
+    virtual void beginUnit();
+
     // Registers a compiler pass
     void registerPass(opt_pass* pass, const PassRegInfo& info);
 
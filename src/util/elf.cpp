@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/elf.h"
+
+#include "util/string.h"
+#include "error.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <cstring>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+using namespace particle;
+
+const char ELF_MAGIC[4] = { 0x7f, 'E', 'L', 'F' };
+const char AR_MAGIC[8] = { '!', '<', 'a', 'r', 'c', 'h', '>', '\n' };
+const char THIN_AR_MAGIC[8] = { '!', '<', 't', 'h', 'i', 'n', '>', '\n' };
+const size_t AR_HEADER_SIZE = 60;
+
+// Special section indices
+const unsigned SHN_LORESERVE = 0xff00;
+const unsigned SHN_XINDEX = 0xffff;
+
+// ELF identification
+enum {
+    EI_CLASS = 4,
+    EI_DATA = 5,
+    ELFCLASS32 = 1,
+    ELFCLASS64 = 2,
+    ELFDATA2LSB = 1,
+    ELFDATA2MSB = 2
+};
+
+// Accessor for the ELF data, which handles both classes and byte orders
+class ElfData {
+public:
+    ElfData(const char* data, size_t size) :
+            d_(data),
+            size_(size),
+            is64_(false),
+            lsb_(true) {
+        if (size_ < 16 || std::memcmp(d_, ELF_MAGIC, sizeof(ELF_MAGIC)) != 0) {
+            throw Error("Not an ELF file");
+        }
+        if ((d_[EI_CLASS] != ELFCLASS32 && d_[EI_CLASS] != ELFCLASS64) ||
+                (d_[EI_DATA] != ELFDATA2LSB && d_[EI_DATA] != ELFDATA2MSB)) {
+            throw Error("Unsupported ELF file");
+        }
+        is64_ = (d_[EI_CLASS] == ELFCLASS64);
+        lsb_ = (d_[EI_DATA] == ELFDATA2LSB);
+    }
+
+    uint64_t uint(size_t offs, size_t size) const {
+        if (offs + size > size_ || offs + size < offs) {
+            throw Error("Invalid format of the ELF file");
+        }
+        uint64_t val = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const uint64_t b = (uint8_t)d_[offs + (lsb_ ? size - i - 1 : i)];
+            val = (val << 8) | b;
+        }
+        return val;
+    }
+
+    // Returns a value of an address-sized field
+    uint64_t addr(size_t offs) const {
+        return uint(offs, is64_ ? 8 : 4);
+    }
+
+    std::string str(size_t offs) const {
+        if (offs >= size_) {
+            throw Error("Invalid format of the ELF file");
+        }
+        const char* const end = static_cast<const char*>(std::memchr(d_ + offs, 0, size_ - offs));
+        if (!end) {
+            throw Error("Invalid format of the ELF file");
+        }
+        return std::string(d_ + offs, end - d_ - offs);
+    }
+
+    std::string data(uint64_t offs, uint64_t size) const {
+        if (offs + size > size_ || offs + size < offs) {
+            throw Error("Invalid format of the ELF file");
+        }
+        return std::string(d_ + offs, size);
+    }
+
+    bool is64() const {
+        return is64_;
+    }
+
+private:
+    const char* d_;
+    size_t size_;
+    bool is64_, lsb_;
+};
+
+void readSections(const char* data, size_t size, const std::string& name, std::vector<std::string>* sections) {
+    const ElfData elf(data, size);
+    const bool is64 = elf.is64();
+    // ELF header
+    const uint64_t shOffs = elf.addr(is64 ? 0x28 : 0x20);
+    const unsigned shEntSize = elf.uint(is64 ? 0x3a : 0x2e, 2);
+    uint64_t shNum = elf.uint(is64 ? 0x3c : 0x30, 2);
+    uint64_t shStrIndex = elf.uint(is64 ? 0x3e : 0x32, 2);
+    if (shOffs == 0) {
+        return; // No sections
+    }
+    // Section headers
+    const auto shOffsField = [=](uint64_t index) {
+        return shOffs + index * shEntSize;
+    };
+    // With the extended section numbering, the number of sections and the index of the section name string table
+    // are stored in the `sh_size` and `sh_link` fields of the first section header respectively
+    if (shNum == 0) {
+        shNum = elf.addr(shOffsField(0) + (is64 ? 0x20 : 0x14));
+    }
+    if (shStrIndex == SHN_XINDEX) {
+        shStrIndex = elf.uint(shOffsField(0) + (is64 ? 0x28 : 0x18), 4);
+    } else if (shStrIndex >= SHN_LORESERVE) {
+        throw Error("Invalid format of the ELF file");
+    }
+    if (shNum == 0) {
+        return; // No sections
+    }
+    if (shStrIndex >= shNum || shEntSize < (is64 ? 0x40u : 0x28u) || shNum > size / shEntSize) {
+        throw Error("Invalid format of the ELF file");
+    }
+    const uint64_t strTabOffs = elf.addr(shOffsField(shStrIndex) + (is64 ? 0x18 : 0x10));
+    for (uint64_t i = 0; i < shNum; ++i) {
+        const uint64_t sh = shOffsField(i);
+        const std::string secName = elf.str(strTabOffs + elf.uint(sh, 4));
+        if (secName != name) {
+            continue;
+        }
+        const uint64_t offs = elf.addr(sh + (is64 ? 0x18 : 0x10));
+        const uint64_t secSize = elf.addr(sh + (is64 ? 0x20 : 0x14));
+        sections->push_back(elf.data(offs, secSize));
+    }
+}
+
+bool isArchive(const std::string& data) {
+    return (data.size() >= sizeof(AR_MAGIC) && (std::memcmp(data.data(), AR_MAGIC, sizeof(AR_MAGIC)) == 0 ||
+            std::memcmp(data.data(), THIN_AR_MAGIC, sizeof(THIN_AR_MAGIC)) == 0));
+}
+
+bool isElf(const char* data, size_t size) {
+    return (size >= sizeof(ELF_MAGIC) && std::memcmp(data, ELF_MAGIC, sizeof(ELF_MAGIC)) == 0);
+}
+
+// Returns the name of an archive member, looking it up in the table of long names if necessary
+std::string memberFileName(const std::string& memberName, const std::string& longNames) {
+    if (memberName.size() > 1 && memberName.front() == '/') {
+        const size_t offs = fromStr<size_t>(memberName.substr(1));
+        const size_t end = longNames.find("/\n", offs);
+        if (offs >= longNames.size() || end == std::string::npos) {
+            throw Error("Invalid format of the archive file");
+        }
+        return longNames.substr(offs, end - offs);
+    }
+    if (!memberName.empty() && memberName.back() == '/') {
+        return memberName.substr(0, memberName.size() - 1);
+    }
+    return memberName;
+}
+
+void readFileSections(const std::string& file, const std::string& name, bool isMember,
+        std::vector<std::string>* sections);
+
+void readArchiveSections(const std::string& file, const std::string& data, const std::string& name,
+        std::vector<std::string>* sections) {
+    // Members of a thin archive are stored in separate files, except for the symbol table and the table of
+    // long names. The paths of the member files are relative to the directory of the archive
+    const bool thin = (std::memcmp(data.data(), THIN_AR_MAGIC, sizeof(THIN_AR_MAGIC)) == 0);
+    std::string longNames;
+    size_t offs = sizeof(AR_MAGIC);
+    while (offs + AR_HEADER_SIZE <= data.size()) {
+        const std::string memberName = boost::trim_copy(data.substr(offs, 16));
+        const size_t memberSize = fromStr<size_t>(boost::trim_copy(data.substr(offs + 48, 10)));
+        offs += AR_HEADER_SIZE;
+        const bool isTable = (memberName == "/" || memberName == "//" || memberName == "/SYM64/");
+        const size_t dataSize = (thin && !isTable) ? 0 : memberSize;
+        if (dataSize > data.size() - offs) {
+            throw Error("Invalid format of the archive file");
+        }
+        if (memberName == "//") {
+            longNames = data.substr(offs, dataSize);
+        } else if (isTable) {
+            // Skip the symbol table
+        } else if (thin) {
+            fs::path memberFile = memberFileName(memberName, longNames);
+            if (memberFile.is_relative()) {
+                memberFile = fs::path(file).parent_path() / memberFile;
+            }
+            readFileSections(memberFile.string(), name, true, sections);
+        } else if (isElf(data.data() + offs, memberSize)) {
+            readSections(data.data() + offs, memberSize, name, sections);
+        }
+        offs += dataSize + (dataSize & 1); // Members are aligned on an even boundary
+    }
+}
+
+void readFileSections(const std::string& file, const std::string& name, bool isMember,
+        std::vector<std::string>* sections) {
+    std::ifstream strm;
+    strm.exceptions(std::ios::badbit); // Enable exceptions
+    strm.open(file, std::ios::in | std::ios::binary);
+    if (!strm.is_open()) {
+        throw Error("Unable to open file: %s", file);
+    }
+    const std::string data((std::istreambuf_iterator<char>(strm)), std::istreambuf_iterator<char>());
+    try {
+        if (isArchive(data)) {
+            readArchiveSections(file, data, name, sections);
+        } else if (!isMember || isElf(data.data(), data.size())) {
+            // Archive members that are not ELF files are skipped
+            readSections(data.data(), data.size(), name, sections);
+        }
+    } catch (const Error& e) {
+        throw Error("%s: %s", file, e.message());
+    }
+}
+
+} // namespace
+
+std::vector<std::string> particle::readElfSections(const std::string& file, const std::string& name) {
+    std::vector<std::string> sections;
+    readFileSections(file, name, false, &sections);
+    return sections;
+}
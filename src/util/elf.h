@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+namespace particle {
+
+// Returns contents of the sections with the specified name. `file` can be an ELF file or an archive of
+// ELF files, in which case the sections of all archive members are returned. Thin archives are supported,
+// as well as ELF files using the extended section numbering
+std::vector<std::string> readElfSections(const std::string& file, const std::string& name);
+
+} // namespace particle
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <cstring>
+
+namespace particle {
+
+// 64-bit FNV-1a hash. Unlike std::hash, the hash values are guaranteed to be stable across builds and hosts
+class Fnv1aHash {
+public:
+    Fnv1aHash();
+
+    Fnv1aHash& add(const char* data, size_t size);
+    Fnv1aHash& add(const std::string& str);
+    Fnv1aHash& add(char c);
+
+    uint64_t value() const;
+
+private:
+    uint64_t h_;
+};
+
+// 64-bit MurmurHash2 (MurmurHash64A). The data is processed 8 bytes at a time, which makes this function
+// considerably faster than FNV-1a for longer strings, but the hash values depend on the byte order of the host
+uint64_t murmurHash64(const char* data, size_t size, uint64_t seed = 0);
+
+} // namespace particle
+
+inline particle::Fnv1aHash::Fnv1aHash() :
+        h_(0xcbf29ce484222325ull) {
+}
+
+inline particle::Fnv1aHash& particle::Fnv1aHash::add(const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        h_ = (h_ ^ (uint8_t)data[i]) * 0x100000001b3ull;
+    }
+    return *this;
+}
+
+inline particle::Fnv1aHash& particle::Fnv1aHash::add(const std::string& str) {
+    return add(str.data(), str.size());
+}
+
+inline particle::Fnv1aHash& particle::Fnv1aHash::add(char c) {
+    return add(&c, 1);
+}
+
+inline uint64_t particle::Fnv1aHash::value() const {
+    return h_;
+}
+
+inline uint64_t particle::murmurHash64(const char* data, size_t size, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    uint64_t h = seed ^ (size * m);
+    const char* const end = data + (size & ~(size_t)7);
+    for (; data != end; data += 8) {
+        uint64_t k = 0;
+        std::memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (size & 7) {
+    case 7:
+        h ^= (uint64_t)(uint8_t)data[6] << 48; // Fall through
+    case 6:
+        h ^= (uint64_t)(uint8_t)data[5] << 40; // Fall through
+    case 5:
+        h ^= (uint64_t)(uint8_t)data[4] << 32; // Fall through
+    case 4:
+        h ^= (uint64_t)(uint8_t)data[3] << 24; // Fall through
+    case 3:
+        h ^= (uint64_t)(uint8_t)data[2] << 16; // Fall through
+    case 2:
+        h ^= (uint64_t)(uint8_t)data[1] << 8; // Fall through
+    case 1:
+        h ^= (uint64_t)(uint8_t)data[0];
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
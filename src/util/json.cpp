@@ -30,6 +30,7 @@
 #include <rapidjson/reader.h>
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/istreamwrapper.h>
+#include <rapidjson/memorystream.h>
 #include <rapidjson/ostreamwrapper.h>
 #include <rapidjson/error/en.h>
 
@@ -46,32 +47,32 @@ public:
     }
 
     bool Null() {
-        h_->value(Variant());
+        h_->nullValue();
         return true;
     }
 
     bool Bool(bool val) {
-        h_->value(val);
+        h_->boolValue(val);
         return true;
     }
 
     bool Int(int val) {
-        h_->value(val);
+        h_->intValue(val);
         return true;
     }
 
     bool Uint(unsigned val) {
-        h_->value(val);
+        h_->uintValue(val);
         return true;
     }
 
     bool Double(double val) {
-        h_->value(val);
+        h_->doubleValue(val);
         return true;
     }
 
     bool String(const char* str, json::SizeType size, bool /* copy */) {
-        h_->value(std::string(str, size));
+        h_->rawString(str, size);
         return true;
     }
 
@@ -81,7 +82,7 @@ public:
     }
 
     bool Key(const char* str, json::SizeType size, bool /* copy */) {
-        h_->name(std::string(str, size));
+        h_->rawName(str, size);
         return true;
     }
 
@@ -107,12 +108,12 @@ private:
 } // namespace
 
 struct particle::JsonReader::Data {
-    json::IStreamWrapper strm;
+    std::unique_ptr<json::IStreamWrapper> strm;
+    std::unique_ptr<json::MemoryStream> memStrm;
     json::GenericReader<json::UTF8<>, json::UTF8<>> reader;
     HandlerAdapter handler;
 
-    Data(std::istream* strm, JsonReader::Handler* handler) :
-            strm(*strm),
+    explicit Data(JsonReader::Handler* handler) :
             handler(handler) {
     }
 };
@@ -128,7 +129,13 @@ struct particle::JsonWriter::Data {
 };
 
 particle::JsonReader::JsonReader(std::istream* strm, Handler* handler) :
-        d_(new Data(strm, handler)) {
+        d_(new Data(handler)) {
+    d_->strm.reset(new json::IStreamWrapper(*strm));
+}
+
+particle::JsonReader::JsonReader(const char* data, size_t size, Handler* handler) :
+        d_(new Data(handler)) {
+    d_->memStrm.reset(new json::MemoryStream(data, size));
 }
 
 particle::JsonReader::~JsonReader() {
@@ -136,7 +143,8 @@ particle::JsonReader::~JsonReader() {
 
 void particle::JsonReader::parse() {
     constexpr unsigned flags = json::kParseCommentsFlag; // Allow comments
-    const json::ParseResult r = d_->reader.Parse<flags>(d_->strm, d_->handler);
+    const json::ParseResult r = d_->memStrm ? d_->reader.Parse<flags>(*d_->memStrm, d_->handler) :
+            d_->reader.Parse<flags>(*d_->strm, d_->handler);
     if (!r) {
         const auto code = r.Code();
         if (code != json::kParseErrorDocumentEmpty) { // Empty document is not an error
@@ -145,6 +153,30 @@ void particle::JsonReader::parse() {
     }
 }
 
+void particle::JsonReader::parseElements() {
+    assert(d_->memStrm);
+    json::MemoryStream& strm = *d_->memStrm;
+    constexpr unsigned flags = json::kParseCommentsFlag | json::kParseStopWhenDoneFlag;
+    for (;;) {
+        const json::ParseResult r = d_->reader.Parse<flags>(strm, d_->handler);
+        if (!r) {
+            throw Error("Unable to parse JSON: %s", json::GetParseError_En(r.Code()));
+        }
+        json::SkipWhitespace(strm);
+        if (strm.Tell() == strm.size_) {
+            break;
+        }
+        if (strm.Peek() != ',') {
+            throw Error("Unable to parse JSON: %s", json::GetParseError_En(json::kParseErrorArrayMissCommaOrSquareBracket));
+        }
+        strm.Take();
+    }
+}
+
+size_t particle::JsonReader::pos() const {
+    return d_->memStrm ? d_->memStrm->Tell() : d_->strm->Tell();
+}
+
 particle::JsonWriter::JsonWriter(std::ostream* strm) :
         d_(new Data(strm)) {
     d_->writer.SetIndent(' ', 2);
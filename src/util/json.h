@@ -30,10 +30,18 @@ public:
     class Handler;
 
     JsonReader(std::istream* strm, Handler* handler);
+    // Parses data in memory, e.g. a memory-mapped file. The data doesn't need to be null-terminated
+    JsonReader(const char* data, size_t size, Handler* handler);
     ~JsonReader();
 
     void parse();
 
+    // Parses a comma-separated sequence of values, e.g. a part of an array. Only supported for data in memory
+    void parseElements();
+
+    // Returns the number of characters consumed so far
+    size_t pos() const;
+
 private:
     struct Data;
 
@@ -50,6 +58,16 @@ public:
     virtual void endArray();
     virtual void name(std::string name);
     virtual void value(Variant val);
+
+    // Typed callbacks that don't allocate memory. The string data is only valid for the duration of a call.
+    // Default implementations forward to the generic callbacks above
+    virtual void rawName(const char* str, size_t size);
+    virtual void rawString(const char* str, size_t size);
+    virtual void nullValue();
+    virtual void boolValue(bool val);
+    virtual void intValue(int val);
+    virtual void uintValue(unsigned val);
+    virtual void doubleValue(double val);
 };
 
 class JsonWriter {
@@ -96,3 +114,31 @@ inline void particle::JsonReader::Handler::name(std::string name) {
 inline void particle::JsonReader::Handler::value(Variant val) {
     // ditto
 }
+
+inline void particle::JsonReader::Handler::rawName(const char* str, size_t size) {
+    name(std::string(str, size));
+}
+
+inline void particle::JsonReader::Handler::rawString(const char* str, size_t size) {
+    value(std::string(str, size));
+}
+
+inline void particle::JsonReader::Handler::nullValue() {
+    value(Variant());
+}
+
+inline void particle::JsonReader::Handler::boolValue(bool val) {
+    value(val);
+}
+
+inline void particle::JsonReader::Handler::intValue(int val) {
+    value(val);
+}
+
+inline void particle::JsonReader::Handler::uintValue(unsigned val) {
+    value(val);
+}
+
+inline void particle::JsonReader::Handler::doubleValue(double val) {
+    value(val);
+}
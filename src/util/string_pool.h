@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017 Particle Industries, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "common.h"
+
+#include <unordered_set>
+
+namespace particle {
+
+// Pool of interned strings. Equal strings added to the pool share the same instance, which remains valid until
+// the pool is cleared
+class StringPool {
+public:
+    const std::string& add(const std::string& str);
+    const std::string& add(std::string&& str);
+
+    // Returns the empty string instance
+    const std::string& empty() const;
+
+    size_t size() const;
+    void clear();
+
+private:
+    std::unordered_set<std::string> strs_;
+    std::string empty_;
+};
+
+} // namespace particle
+
+inline const std::string& particle::StringPool::add(const std::string& str) {
+    if (str.empty()) {
+        return empty_;
+    }
+    return *strs_.insert(str).first;
+}
+
+inline const std::string& particle::StringPool::add(std::string&& str) {
+    if (str.empty()) {
+        return empty_;
+    }
+    return *strs_.insert(std::move(str)).first;
+}
+
+inline const std::string& particle::StringPool::empty() const {
+    return empty_;
+}
+
+inline size_t particle::StringPool::size() const {
+    return strs_.size();
+}
+
+inline void particle::StringPool::clear() {
+    strs_.clear();
+}